@@ -15,8 +15,20 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "mm.h"
+#include "mmprof.h"
+#include "mmguard.h"
+#include "mmslab.h"
+#include "mmgran.h"
+#include "mmlock.h"
+#include "mmarena.h"
+#include "mmcache.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
@@ -30,6 +42,31 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Shape of the request-scoped benchmark (-A) */
+#define SCOPE_REQS    2000 /* simulated requests per run */
+#define SCOPE_OBJS      64 /* objects allocated by each request */
+#define SCOPE_MAXSIZE  512 /* largest object size in bytes */
+
+/* Maintenance thread used by the latency comparison (-L) */
+#define MAINT_PERIOD  1000 /* microseconds between maintenance passes */
+#define MAINT_DUTY      50 /* percent of each period it may work */
+
+/* Shape of the multithreaded benchmark (-M) */
+#define THREADS_PER_CPU   8 /* threads started per online CPU */
+#define THREAD_OPS    50000 /* mm_free/mm_malloc pairs per thread */
+#define THREAD_LIVE      64 /* objects each thread keeps live */
+#define THREAD_MAXSIZE  240 /* largest object size in bytes */
+
+/* Shape of the object cache check and benchmark (-O) */
+#define CACHE_OBJS     4096 /* objects live at once, spread over many slabs */
+#define CACHE_OBJSIZE   200 /* object size in bytes */
+#define CACHE_ALIGN      64 /* object alignment */
+#define CACHE_ROUNDS     20 /* times each timed run allocates and frees them */
+#define CACHE_MAGIC 0x0bc0ffee /* set by the constructor, cleared by the dtor */
+
+/* Guarded allocation pool used with -G */
+#define GUARD_SLOTS    256 /* blocks that can be guarded at once */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -53,7 +90,7 @@ typedef struct {
 
 /* Holds the information for one trace file*/
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
+    int sugg_heapsize;   /* suggested heap size (reserved by -P) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
@@ -72,6 +109,31 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Object sizes for the request-scoped benchmark, one row per request */
+typedef struct {
+    int sizes[SCOPE_REQS][SCOPE_OBJS];
+} scope_t;
+
+/* An object of the object cache benchmark, kept in constructed state */
+typedef struct {
+    unsigned magic;  /* CACHE_MAGIC while constructed */
+    int busy;        /* set while handed out */
+    char data[CACHE_OBJSIZE - 2 * sizeof(int)];
+} cache_obj_t;
+
+/* The cache and the live objects of the object cache benchmark */
+typedef struct {
+    mm_cache_t *cache;
+    cache_obj_t *objs[CACHE_OBJS];
+} cache_test_t;
+
+/* Foreground latency of the requests in one replay of a trace */
+typedef struct {
+    double mean;  /* nanoseconds per request */
+    double p99;   /* 99th percentile */
+    double max;   /* slowest request */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,8 +143,10 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double heap;     /* heap bytes at the end of the trace (0 for libc) */
+    double resident; /* bytes of that heap in physical memory */
 
-    /* Note: secs and util are only defined if valid is true */
+    /* Note: secs, util, heap and resident are only defined if valid is true */
 } stats_t; 
 
 /********************
@@ -92,6 +156,25 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Heap consistency checks run by eval_mm_valid (set by -c, -C, -e) */
+static int check_last = 0;   /* O(1) check of the block touched by each op */
+static int check_every = 0;  /* full heap walk every check_every ops */
+static int check_end = 0;    /* full heap walk at the end of each trace */
+
+/* Prefault the heap and reserve sugg_heapsize before timing (set by -P) */
+static int prefault = 0;
+
+/* Simulated time for timestamped replays (set by -T) */
+static unsigned long replay_step = 0;  /* microseconds between requests */
+static unsigned long replay_clock = 0; /* current simulated time */
+
+/* Threads of the -M benchmark free through mm_free_deferred */
+static int thread_deferred = 0;
+
+/* Objects constructed and destroyed during the -O check */
+static long cache_ctors = 0;
+static long cache_dtors = 0;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -124,9 +207,53 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_heapmap(trace_t *trace, int tracenum, char *prefix);
+
+/* Routines for the request-scoped benchmark: per-object free vs arenas */
+static void eval_scope(void);
+static void eval_scope_free(void *ptr);
+static void eval_scope_arena(void *ptr);
+
+/* checks the object caches and compares them with mm_malloc/mm_free */
+static void eval_caches(void);
+static void eval_caches_round(cache_test_t *test, char *what);
+static void eval_caches_malloc(void *ptr);
+static void eval_caches_cache(void *ptr);
+static void cache_ctor(void *obj);
+static void cache_dtor(void *obj);
+static int cmp_ptr(const void *a, const void *b);
+
+/* measures request latency with and without background maintenance */
+static void eval_latency(char **tracefiles, int num_tracefiles);
+static void eval_mm_latency(trace_t *trace, int maint, latency_t *lat);
+static int cmp_long(const void *a, const void *b);
+
+/* compares per-CPU and per-thread caches and deferred frees with more
+   threads than CPUs */
+static void eval_threads(void);
+static void *eval_thread(void *arg);
+static void thread_free(char *p);
+
+/* measures the free path with and without size-class slabs */
+static void eval_slabs(char **tracefiles, int num_tracefiles);
+static double eval_mm_free_ns(trace_t *trace);
+
+/* measures replays with and without the granule bitmaps */
+static void eval_bitmaps(char **tracefiles, int num_tracefiles);
+
+/* measures dTLB misses with and without huge pages */
+static void eval_hugepages(char **tracefiles, int num_tracefiles);
+static long long count_dtlb_misses(void (*f)(void *), void *arg);
+
+/* reserves a trace's suggested heap size in prefault mode */
+static void reserve_heap(trace_t *trace, char *caller);
+
+/* the decay clock during timestamped replays */
+static unsigned long replay_now(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void print_mm_events(int tracenum, char *filename);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -148,6 +275,16 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int run_scope = 0;   /* If set, run the request-scoped benchmark (-A) */
+    int run_latency = 0; /* If set, compare request latencies (-L) */
+    int run_huge = 0;    /* If set, compare dTLB misses (-H) */
+    int run_threads = 0; /* If set, compare thread caches (-M) */
+    int run_slabs = 0;   /* If set, compare size-class slabs (-S) */
+    int run_bitmaps = 0; /* If set, compare granule bitmaps (-B) */
+    int run_caches = 0;  /* If set, check and time object caches (-O) */
+    size_t prof_rate = 0;/* If set, run the heap profiler (set by -p) */
+    int guard_rate = 0;  /* If set, guard sampled blocks (set by -G) */
+    char *heapmap = NULL;/* If set, dump heap maps at peak use (set by -m) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
 
     /* temporaries used to compute the performance index */
@@ -157,7 +294,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcC:D:eG:p:m:R:T:ABHLMOPS")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -170,6 +307,10 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+	case 'T': /* Replay on a simulated clock, <usec> per request */
+	    replay_step = atol(optarg);
+	    mm_decay_clock(replay_now);
+	    break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -177,6 +318,55 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'A': /* Compare mm_free with arenas for request-scoped objects */
+            run_scope = 1;
+            break;
+        case 'B': /* Compare replays with and without granule bitmaps */
+            run_bitmaps = 1;
+            break;
+        case 'c': /* Check the block touched by every request */
+            check_last = 1;
+            break;
+        case 'C': /* Walk the whole heap every n requests */
+            check_every = atoi(optarg);
+            break;
+        case 'D': /* Release free pages gradually over <ms> milliseconds */
+            mm_decay(atol(optarg));
+            break;
+        case 'e': /* Walk the whole heap at the end of each trace */
+            check_end = 1;
+            break;
+        case 'G': /* Guard one mm_malloc call in <n> */
+            guard_rate = atoi(optarg);
+            break;
+        case 'H': /* Compare dTLB misses with and without huge pages */
+            run_huge = 1;
+            break;
+        case 'L': /* Compare latency with and without the maintenance thread */
+            run_latency = 1;
+            break;
+        case 'M': /* Compare per-CPU and per-thread caches */
+            run_threads = 1;
+            break;
+        case 'm': /* Write a heap map at the peak of each trace */
+            heapmap = optarg;
+            break;
+        case 'O': /* Check object caches and compare them with mm_malloc */
+            run_caches = 1;
+            break;
+        case 'P': /* Prefault the heap and reserve the suggested size */
+            prefault = 1;
+            mem_prefault(1);
+            break;
+        case 'p': /* Sample mm_malloc every <rate> bytes on average */
+            prof_rate = atol(optarg);
+            break;
+        case 'R': /* Release the pages of free blocks of >= n bytes */
+            mm_release_threshold(atol(optarg));
+            break;
+        case 'S': /* Compare mm_free with and without size-class slabs */
+            run_slabs = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
@@ -257,6 +447,17 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /* Optionally profile mm_malloc; SIGUSR1 writes the live samples */
+    if (prof_rate > 0) {
+	mm_prof_start(prof_rate);
+	if (mm_prof_dump_on_signal(SIGUSR1, "mm.prof") < 0)
+	    unix_error("mm_prof_dump_on_signal failed in main");
+    }
+
+    /* Optionally serve sampled mm_malloc calls from guarded pages */
+    if (guard_rate > 0 && mm_guard_start(guard_rate, GUARD_SLOTS) < 0)
+	unix_error("mm_guard_start failed in main");
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
@@ -268,11 +469,17 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].heap = mem_heapsize();
+	    mm_stats[i].resident = mem_resident();
+	    if (heapmap)
+		eval_mm_heapmap(trace, i, heapmap);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (verbose)
+		print_mm_events(i, tracefiles[i]);
 	}
 	free_trace(trace);
     }
@@ -284,6 +491,34 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Optionally run the request-scoped arena benchmark */
+    if (run_scope)
+	eval_scope();
+
+    /* Optionally check and time the object caches */
+    if (run_caches)
+	eval_caches();
+
+    /* Optionally compare latencies with background maintenance */
+    if (run_latency)
+	eval_latency(tracefiles, num_tracefiles);
+
+    /* Optionally compare dTLB misses on small and huge pages */
+    if (run_huge)
+	eval_hugepages(tracefiles, num_tracefiles);
+
+    /* Optionally compare the thread caches under oversubscription */
+    if (run_threads)
+	eval_threads();
+
+    /* Optionally compare the free path with and without the slabs */
+    if (run_slabs)
+	eval_slabs(tracefiles, num_tracefiles);
+
+    /* Optionally compare replays with and without the granule bitmaps */
+    if (run_bitmaps)
+	eval_bitmaps(tracefiles, num_tracefiles);
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -365,9 +600,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or guard pool,
+       slabs or spans) */
+    if (!MM_GUARD_OWNS(lo) && !MM_SLAB_OWNS(lo) && !MM_GRAN_OWNS(lo) && ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -648,6 +884,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Optionally check the heap after the request */
+	if (check_last && !mm_check_last()) {
+	    malloc_error(tracenum, i, "mm_check_last found an inconsistency.");
+	    return 0;
+	}
+	if (check_every > 0 && (i + 1) % check_every == 0 && !mm_check()) {
+	    malloc_error(tracenum, i, "mm_check found an inconsistency.");
+	    return 0;
+	}
+    }
+
+    if (check_end && !mm_check()) {
+	malloc_error(tracenum, trace->num_ops - 1, 
+		     "mm_check found an inconsistency at the end of the trace.");
+	return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -681,6 +932,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	replay_clock += replay_step;
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
@@ -748,6 +1000,81 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 }
 
 
+/*
+ * eval_mm_heapmap - Replay the trace up to the request where the total
+ *    size of the allocated payloads peaks and write the allocator's page
+ *    occupancy map at that point to <prefix>-<tracenum>.ppm.
+ */
+static void eval_mm_heapmap(trace_t *trace, int tracenum, char *prefix)
+{
+    int i, peak;
+    int index, size;
+    int total_size = 0, max_total_size = 0;
+    char *p;
+    char path[MAXLINE / 2];     /* leaves room for it in msg */
+    FILE *fp;
+
+    /* Find the request after which the most payload bytes are live */
+    peak = 0;
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total_size += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    peak = i;
+	}
+    }
+
+    /* Replay the trace up to and including that request */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_heapmap");
+    for (i = 0;  i <= peak;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_heapmap");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_heapmap");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+    }
+
+    if (snprintf(path, sizeof(path), "%s-%d.ppm", prefix, tracenum) >=
+	(int)sizeof(path))
+	app_error("heap map prefix too long in eval_mm_heapmap");
+    if ((fp = fopen(path, "wb")) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not open %s in eval_mm_heapmap", path);
+	unix_error(msg);
+    }
+    if (mm_heapmap(fp) < 0)
+	app_error("mm_heapmap failed in eval_mm_heapmap");
+    fclose(fp);
+    if (verbose > 1)
+	printf("Wrote heap map at request %d to %s, ", peak, path);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -762,6 +1089,7 @@ static void eval_mm_speed(void *ptr)
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    reserve_heap(trace, "eval_mm_speed");
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -795,6 +1123,673 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_scope - Time a workload where every simulated request allocates
+ *    SCOPE_OBJS objects that all die when the request ends, once with
+ *    mm_malloc/mm_free per object and once with an arena that is reset
+ *    at the end of each request.
+ */
+static void eval_scope(void)
+{
+    scope_t *scope;
+    int i, j;
+    double ops, free_secs, arena_secs;
+
+    if ((scope = (scope_t *)malloc(sizeof(scope_t))) == NULL)
+	unix_error("malloc failed in eval_scope");
+    srand(1);
+    for (i = 0; i < SCOPE_REQS; i++)
+	for (j = 0; j < SCOPE_OBJS; j++)
+	    scope->sizes[i][j] = 8 + rand() % (SCOPE_MAXSIZE - 8);
+
+    free_secs = fsecs(eval_scope_free, scope);
+    arena_secs = fsecs(eval_scope_arena, scope);
+    ops = (double)SCOPE_REQS * SCOPE_OBJS;
+
+    printf("Request-scoped allocation (%d requests x %d objects):\n",
+	   SCOPE_REQS, SCOPE_OBJS);
+    printf("%20s%10s%8s\n", "", "secs", "Kops");
+    printf("%20s%10.6f%8.0f\n", "mm_malloc/mm_free", 
+	   free_secs, (ops/1e3)/free_secs);
+    printf("%20s%10.6f%8.0f\n\n", "mm_arena", 
+	   arena_secs, (ops/1e3)/arena_secs);
+    free(scope);
+}
+
+/*
+ * eval_scope_free - request-scoped objects freed one at a time
+ */
+static void eval_scope_free(void *ptr)
+{
+    scope_t *scope = (scope_t *)ptr;
+    char *objs[SCOPE_OBJS];
+    int i, j;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_scope_free");
+    for (i = 0; i < SCOPE_REQS; i++) {
+	for (j = 0; j < SCOPE_OBJS; j++) {
+	    if ((objs[j] = mm_malloc(scope->sizes[i][j])) == NULL)
+		app_error("mm_malloc failed in eval_scope_free");
+	    objs[j][0] = j;
+	}
+	for (j = 0; j < SCOPE_OBJS; j++)
+	    mm_free(objs[j]);
+    }
+}
+
+/*
+ * eval_scope_arena - request-scoped objects released by an arena reset
+ */
+static void eval_scope_arena(void *ptr)
+{
+    scope_t *scope = (scope_t *)ptr;
+    mm_arena_t *arena;
+    char *p;
+    int i, j;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_scope_arena");
+    if ((arena = mm_arena_create(0)) == NULL)
+	app_error("mm_arena_create failed in eval_scope_arena");
+    for (i = 0; i < SCOPE_REQS; i++) {
+	for (j = 0; j < SCOPE_OBJS; j++) {
+	    if ((p = mm_arena_alloc(arena, scope->sizes[i][j])) == NULL)
+		app_error("mm_arena_alloc failed in eval_scope_arena");
+	    p[0] = j;
+	}
+	mm_arena_reset(arena);
+    }
+    mm_arena_destroy(arena);
+}
+
+/*
+ * eval_caches - Check that an object cache with a constructor and a
+ *    destructor hands out constructed, aligned objects spread over many
+ *    slabs, and that it reuses them once freed instead of constructing
+ *    new ones. Then time CACHE_OBJS objects allocated and freed with
+ *    the cache and with mm_malloc/mm_free plus the constructor.
+ */
+static void eval_caches(void)
+{
+    cache_test_t *test;
+    cache_obj_t **first;
+    long ctors;
+    int i;
+    double ops, malloc_secs, cache_secs;
+
+    if ((test = (cache_test_t *)malloc(sizeof(cache_test_t))) == NULL ||
+	(first = (cache_obj_t **)malloc(sizeof(test->objs))) == NULL)
+	unix_error("malloc failed in eval_caches");
+    test->cache = mm_cache_create(sizeof(cache_obj_t), CACHE_ALIGN, 
+				  cache_ctor, cache_dtor);
+    if (test->cache == NULL)
+	app_error("mm_cache_create failed in eval_caches");
+
+    /* the first round constructs every object */
+    cache_ctors = cache_dtors = 0;
+    eval_caches_round(test, "first");
+    if ((ctors = cache_ctors) < CACHE_OBJS)
+	app_error("mm_cache_alloc returned unconstructed objects");
+    memcpy(first, test->objs, sizeof(test->objs));
+    qsort(first, CACHE_OBJS, sizeof(cache_obj_t *), cmp_ptr);
+
+    /* free every other object first, leaving every slab partial */
+    for (i = 0; i < CACHE_OBJS; i += 2) {
+	test->objs[i]->busy = 0;
+	mm_cache_free(test->cache, test->objs[i]);
+    }
+    for (i = 1; i < CACHE_OBJS; i += 2) {
+	test->objs[i]->busy = 0;
+	mm_cache_free(test->cache, test->objs[i]);
+    }
+
+    /* the second round must get the same objects back, unconstructed */
+    eval_caches_round(test, "second");
+    if (cache_ctors != ctors)
+	app_error("mm_cache_alloc constructed objects it could have reused");
+    for (i = 0; i < CACHE_OBJS; i++) {
+	if (bsearch(&test->objs[i], first, CACHE_OBJS, sizeof(cache_obj_t *),
+		    cmp_ptr) == NULL)
+	    app_error("mm_cache_alloc did not reuse a freed object");
+	test->objs[i]->busy = 0;
+	mm_cache_free(test->cache, test->objs[i]);
+    }
+    mm_cache_destroy(test->cache);
+    if (cache_dtors != ctors)
+	app_error("mm_cache_destroy did not destroy every object");
+
+    if ((test->cache = mm_cache_create(sizeof(cache_obj_t), CACHE_ALIGN, 
+				       cache_ctor, cache_dtor)) == NULL)
+	app_error("mm_cache_create failed in eval_caches");
+    malloc_secs = fsecs(eval_caches_malloc, test);
+    cache_secs = fsecs(eval_caches_cache, test);
+    mm_cache_destroy(test->cache);
+    ops = (double)CACHE_ROUNDS * CACHE_OBJS;
+
+    printf("Object cache (%d objects of %d bytes, %ld constructed): "
+	   "constructed, aligned and reused\n", CACHE_OBJS, 
+	   (int)sizeof(cache_obj_t), ctors);
+    printf("%20s%10s%8s\n", "", "secs", "Kops");
+    printf("%20s%10.6f%8.0f\n", "mm_malloc/mm_free", 
+	   malloc_secs, (ops/1e3)/malloc_secs);
+    printf("%20s%10.6f%8.0f\n\n", "mm_cache", 
+	   cache_secs, (ops/1e3)/cache_secs);
+    free(first);
+    free(test);
+}
+
+/*
+ * eval_caches_round - allocate CACHE_OBJS objects from the test cache
+ *    and check that each is constructed, aligned and not handed out twice
+ */
+static void eval_caches_round(cache_test_t *test, char *what)
+{
+    cache_obj_t *obj;
+    int i;
+
+    for (i = 0; i < CACHE_OBJS; i++) {
+	if ((obj = mm_cache_alloc(test->cache)) == NULL) {
+	    sprintf(msg, "mm_cache_alloc failed in the %s round", what);
+	    app_error(msg);
+	}
+	if ((size_t)obj % CACHE_ALIGN != 0) {
+	    sprintf(msg, "mm_cache_alloc returned %p, not %d-byte aligned",
+		    (void *)obj, CACHE_ALIGN);
+	    app_error(msg);
+	}
+	if (obj->magic != CACHE_MAGIC || obj->busy) {
+	    sprintf(msg, "mm_cache_alloc returned %p %s in the %s round",
+		    (void *)obj, obj->busy ? "twice" : "unconstructed", what);
+	    app_error(msg);
+	}
+	obj->busy = 1;
+	test->objs[i] = obj;
+    }
+}
+
+/*
+ * eval_caches_malloc - objects allocated with mm_malloc, constructed on
+ *    every allocation and destroyed on every free
+ */
+static void eval_caches_malloc(void *ptr)
+{
+    cache_test_t *test = (cache_test_t *)ptr;
+    int i, j;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_caches_malloc");
+    for (i = 0; i < CACHE_ROUNDS; i++) {
+	for (j = 0; j < CACHE_OBJS; j++) {
+	    if ((test->objs[j] = mm_malloc(sizeof(cache_obj_t))) == NULL)
+		app_error("mm_malloc failed in eval_caches_malloc");
+	    cache_ctor(test->objs[j]);
+	}
+	for (j = 0; j < CACHE_OBJS; j++) {
+	    cache_dtor(test->objs[j]);
+	    mm_free(test->objs[j]);
+	}
+    }
+}
+
+/*
+ * eval_caches_cache - objects allocated from the cache, constructed only
+ *    when their slab is made
+ */
+static void eval_caches_cache(void *ptr)
+{
+    cache_test_t *test = (cache_test_t *)ptr;
+    int i, j;
+
+    for (i = 0; i < CACHE_ROUNDS; i++) {
+	for (j = 0; j < CACHE_OBJS; j++)
+	    if ((test->objs[j] = mm_cache_alloc(test->cache)) == NULL)
+		app_error("mm_cache_alloc failed in eval_caches_cache");
+	for (j = 0; j < CACHE_OBJS; j++)
+	    mm_cache_free(test->cache, test->objs[j]);
+    }
+}
+
+/*
+ * cache_ctor - constructor of the object cache benchmark's objects
+ */
+static void cache_ctor(void *obj)
+{
+    cache_obj_t *o = (cache_obj_t *)obj;
+
+    memset(o, 0, sizeof(cache_obj_t));
+    o->magic = CACHE_MAGIC;
+    cache_ctors++;
+}
+
+/*
+ * cache_dtor - destructor of the object cache benchmark's objects
+ */
+static void cache_dtor(void *obj)
+{
+    cache_obj_t *o = (cache_obj_t *)obj;
+
+    if (o->magic != CACHE_MAGIC)
+	app_error("cache_dtor found an object that was not constructed");
+    o->magic = 0;
+    cache_dtors++;
+}
+
+/*
+ * cmp_ptr - qsort and bsearch comparison of two pointers
+ */
+static int cmp_ptr(const void *a, const void *b)
+{
+    char *x = *(char **)a, *y = *(char **)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_latency - Replay every trace twice, once with mm_free doing its
+ *    own coalescing and once with the maintenance thread doing it, and
+ *    print the latency of the requests as seen by the caller.
+ */
+static void eval_latency(char **tracefiles, int num_tracefiles)
+{
+    int i;
+    trace_t *trace;
+    latency_t inl, bg;
+
+    printf("Request latency in ns, without and with the maintenance thread "
+	   "(%dus period, %d%% duty):\n", MAINT_PERIOD, MAINT_DUTY);
+    printf("%5s%10s%10s%10s%10s%10s%10s\n", "trace",
+	   "mean", "p99", "max", "bg mean", "bg p99", "bg max");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	eval_mm_latency(trace, 0, &inl);
+	eval_mm_latency(trace, 1, &bg);
+	printf("%5d%10.0f%10.0f%10.0f%10.0f%10.0f%10.0f\n", i,
+	       inl.mean, inl.p99, inl.max, bg.mean, bg.p99, bg.max);
+	free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_latency - Replay a trace, timing each request on its own
+ */
+static void eval_mm_latency(trace_t *trace, int maint, latency_t *lat)
+{
+    int i, index;
+    char *p;
+    long *ns, total = 0;
+    struct timespec t0, t1;
+
+    if ((ns = (long *)malloc(trace->num_ops * sizeof(long))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+    reserve_heap(trace, "eval_mm_latency");
+    if (maint && mm_maint_start(MAINT_PERIOD, MAINT_DUTY) < 0)
+	app_error("mm_maint_start failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns[i] = (t1.tv_sec - t0.tv_sec) * 1000000000L + 
+	    (t1.tv_nsec - t0.tv_nsec);
+	total += ns[i];
+    }
+    if (maint)
+	mm_maint_stop();
+
+    qsort(ns, trace->num_ops, sizeof(long), cmp_long);
+    lat->mean = (double)total / trace->num_ops;
+    lat->p99 = ns[(int)(trace->num_ops * 0.99)];
+    lat->max = ns[trace->num_ops - 1];
+    free(ns);
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_threads - Run THREADS_PER_CPU threads per CPU that all churn
+ *    small objects through mm_malloc and mm_free, with per-thread caches,
+ *    with per-CPU caches, and with per-thread caches while the frees go
+ *    through mm_free_deferred, and print the throughput, the heap each
+ *    left behind and how often the threads waited for locks.
+ */
+static void eval_threads(void)
+{
+    static char *names[] = {"per-thread caches", "per-CPU caches",
+			    "deferred frees"};
+    int modes[3] = {MM_CACHES_THREAD, MM_CACHES_CPU, MM_CACHES_THREAD};
+    int i, t, nthreads;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *tids;
+    struct timespec t0, t1;
+    double secs, ops;
+
+    nthreads = THREADS_PER_CPU * ncpus;
+    ops = 2.0 * nthreads * THREAD_OPS;
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL)
+	unix_error("malloc failed in eval_threads");
+
+    printf("%d threads on %ld CPUs, %d mm_free/mm_malloc pairs each:\n\n",
+	   nthreads, ncpus, THREAD_OPS);
+    for (i = 0; i < 3; i++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_threads");
+	if (mm_caches(modes[i]) != modes[i]) {
+	    printf("%s: not available\n\n", names[i]);
+	    mm_caches(MM_CACHES_OFF);
+	    continue;
+	}
+	thread_deferred = (i == 2);
+	mm_lock_reset();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (t = 0; t < nthreads; t++)
+	    if (pthread_create(&tids[t], NULL, eval_thread, (void *)(long)t))
+		unix_error("pthread_create failed in eval_threads");
+	for (t = 0; t < nthreads; t++)
+	    pthread_join(tids[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	mm_epoch_flush();
+	printf("%s: %.6f secs, %.0f Kops, %.0f KB heap\n",
+	       names[i], secs, (ops/1e3)/secs, mem_heapsize()/1024.0);
+	mm_lock_print(stdout);
+	printf("\n");
+	mm_caches(MM_CACHES_OFF);
+    }
+    thread_deferred = 0;
+    free(tids);
+}
+
+/*
+ * eval_thread - one thread of eval_threads: replaces a random one of its
+ *    THREAD_LIVE objects at a time, then frees them all and exits. With
+ *    thread_deferred set, each free is deferred from a critical section.
+ */
+static void *eval_thread(void *arg)
+{
+    char *live[THREAD_LIVE] = {NULL};
+    unsigned int seed = (unsigned int)(long)arg + 1;
+    int i, j;
+
+    for (i = 0; i < THREAD_OPS; i++) {
+	j = rand_r(&seed) % THREAD_LIVE;
+	thread_free(live[j]);
+	if ((live[j] = mm_malloc(1 + rand_r(&seed) % THREAD_MAXSIZE)) == NULL)
+	    app_error("mm_malloc failed in eval_thread");
+	live[j][0] = j;
+    }
+    for (j = 0; j < THREAD_LIVE; j++)
+	thread_free(live[j]);
+    return NULL;
+}
+
+/*
+ * thread_free - free p for eval_thread
+ */
+static void thread_free(char *p)
+{
+    if (thread_deferred) {
+	mm_epoch_enter();
+	mm_free_deferred(p);
+	mm_epoch_exit();
+    }
+    else
+	mm_free(p);
+}
+
+/*
+ * eval_slabs - Replay every trace without and with the size-class slabs
+ *    and print the mean time of an mm_free call, less that of reading
+ *    the clock around it, the throughput of the whole replay and the
+ *    heap it ended with, slices included.
+ */
+static void eval_slabs(char **tracefiles, int num_tracefiles)
+{
+    int i, on;
+    trace_t *trace;
+    speed_t params;
+    double ns[2], kops[2], kb[2], clock_ns;
+    struct timespec t0, t1;
+    long total = 0;
+
+    for (i = 0; i < 100000; i++) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	total += (t1.tv_sec - t0.tv_sec) * 1000000000L + 
+	    (t1.tv_nsec - t0.tv_nsec);
+    }
+    clock_ns = total / 100000.0;
+
+    printf("mm_free latency, throughput and heap without and with "
+	   "size-class slabs:\n");
+    printf("%5s%10s%10s%10s%10s%10s%10s\n", "trace", "free ns", "slab ns",
+	   "Kops", "slab Kops", "KB", "slab KB");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	params.trace = trace;
+	for (on = 0; on < 2; on++) {
+	    if (on && mm_slab_start() < 0)
+		unix_error("mm_slab_start failed in eval_slabs");
+	    ns[on] = eval_mm_free_ns(trace) - clock_ns;
+	    kops[on] = trace->num_ops / fsecs(eval_mm_speed, &params) / 1e3;
+	    kb[on] = (mem_heapsize() + mm_slab_heapsize()) / 1024.0;
+	    mm_slab_stop();
+	}
+	printf("%5d%10.1f%10.1f%10.0f%10.0f%10.0f%10.0f\n", i,
+	       ns[0], ns[1], kops[0], kops[1], kb[0], kb[1]);
+	free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_bitmaps - Replay every trace without and with the granule bitmaps
+ *    for medium requests and print the throughput of the whole replay
+ *    and the heap it ended with, spans included.
+ */
+static void eval_bitmaps(char **tracefiles, int num_tracefiles)
+{
+    int i, on;
+    trace_t *trace;
+    speed_t params;
+    double kops[2], kb[2];
+
+    if (mm_gran_start() < 0)
+	unix_error("mm_gran_start failed in eval_bitmaps");
+    mm_gran_stop();
+    printf("throughput and heap without and with granule bitmaps for "
+	   "%d-%d byte requests (%s run search):\n", MM_GRAN_MIN,
+	   MM_GRAN_MAX, mm_gran_search());
+    printf("%5s%10s%12s%10s%12s\n", "trace", "Kops", "bitmap Kops",
+	   "KB", "bitmap KB");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	params.trace = trace;
+	for (on = 0; on < 2; on++) {
+	    if (on)
+		mm_gran_start();
+	    kops[on] = trace->num_ops / fsecs(eval_mm_speed, &params) / 1e3;
+	    kb[on] = (mem_heapsize() + mm_gran_heapsize()) / 1024.0;
+	    mm_gran_stop();
+	}
+	printf("%5d%10.0f%12.0f%10.0f%12.0f\n", i,
+	       kops[0], kops[1], kb[0], kb[1]);
+	free_trace(trace);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_free_ns - Replay a trace, timing each mm_free call on its own,
+ *    and return their mean in nanoseconds
+ */
+static double eval_mm_free_ns(trace_t *trace)
+{
+    int i, index, frees = 0;
+    char *p;
+    long total = 0;
+    struct timespec t0, t1;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_free_ns");
+    reserve_heap(trace, "eval_mm_free_ns");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_free_ns");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_free_ns");
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    mm_free(trace->blocks[index]);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    total += (t1.tv_sec - t0.tv_sec) * 1000000000L + 
+		(t1.tv_nsec - t0.tv_nsec);
+	    frees++;
+	    break;
+	}
+    }
+    return frees ? (double)total / frees : 0.0;
+}
+
+/*
+ * eval_hugepages - Replay every trace once with the heap on 4 KB pages
+ *    and once on transparent huge pages, and print the dTLB load misses
+ *    of each replay, or n/a if the counter is not available.
+ */
+static void eval_hugepages(char **tracefiles, int num_tracefiles)
+{
+    int i, on;
+    trace_t *trace;
+    speed_t params;
+    long long misses[2];
+
+    printf("dTLB load misses per replay, on 4 KB pages and on huge pages:\n");
+    printf("%5s%14s%14s\n", "trace", "4K pages", "huge pages");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	params.trace = trace;
+	for (on = 0; on < 2; on++) {
+	    /* eval_mm_speed's mem_reset_brk drops the old pages first */
+	    mem_hugepages(on);
+	    misses[on] = count_dtlb_misses(eval_mm_speed, &params);
+	}
+	printf("%5d", i);
+	for (on = 0; on < 2; on++) {
+	    if (misses[on] < 0)
+		printf("%14s", "n/a");
+	    else
+		printf("%14lld", misses[on]);
+	}
+	printf("\n");
+	free_trace(trace);
+    }
+    printf("\n");
+    mem_hugepages(1);
+}
+
+/*
+ * count_dtlb_misses - Run f(arg) and return the number of dTLB load
+ *    misses it caused in user space, or -1 if they cannot be counted
+ */
+static long long count_dtlb_misses(void (*f)(void *), void *arg)
+{
+    struct perf_event_attr pe;
+    long long count;
+    int fd;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_DTLB |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    if ((fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0)) < 0) {
+	f(arg);
+	return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    f(arg);
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+	count = -1;
+    close(fd);
+    return count;
+}
+
+/*
+ * reserve_heap - In prefault mode, reserve the trace's suggested heap
+ *    size before it is replayed. Some traces suggest more than the
+ *    simulated memory holds, so at most half of MAX_HEAP is reserved.
+ */
+static void reserve_heap(trace_t *trace, char *caller)
+{
+    size_t size = trace->sugg_heapsize;
+
+    if (!prefault)
+	return;
+    if (size > MAX_HEAP / 2)
+	size = MAX_HEAP / 2;
+    if (mm_reserve(size) < 0) {
+	sprintf(msg, "mm_reserve failed in %s", caller);
+	app_error(msg);
+    }
+}
+
+/*
+ * replay_now - the simulated time, which eval_mm_util advances by
+ *    replay_step microseconds before each request
+ */
+static unsigned long replay_now(void)
+{
+    return replay_clock;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -896,17 +1891,22 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%8s%8s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "heapKB", "rssKB");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].heap > 0)
+		printf("%8.0f%8.0f\n", stats[i].heap/1024, 
+		       stats[i].resident/1024);
+	    else
+		printf("%8s%8s\n", "-", "-");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -942,6 +1942,20 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * print_mm_events - print the allocator's event counters for the last
+ *     replay of a trace. Silent unless mm.c was built with MM_STATS.
+ */
+static void print_mm_events(int tracenum, char *filename)
+{
+    mm_stats_t st;
+
+    if (mm_stats(&st) < 0)
+	return;
+    printf("Allocator events for trace %d (%s):\n", tracenum, filename);
+    mm_stats_print(stdout);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -974,13 +1988,30 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValceABHLMOPS] [-f <file>] [-t <dir>] [-C <n>] [-D <ms>] [-G <n>] [-m <prefix>] [-p <rate>] [-R <n>] [-T <usec>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A         Run the request-scoped arena benchmark.\n");
+    fprintf(stderr, "\t-B         Compare throughput and heap with and without granule bitmaps.\n");
+    fprintf(stderr, "\t-c         Check the block touched by each request.\n");
+    fprintf(stderr, "\t-C <n>     Check the whole heap every <n> requests.\n");
+    fprintf(stderr, "\t-D <ms>    Release free pages gradually over <ms> milliseconds.\n");
+    fprintf(stderr, "\t-e         Check the whole heap at the end of each trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G <n>     Put one mm_malloc call in <n> next to a guard page.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Compare dTLB misses on 4 KB and huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Compare request latency with background maintenance.\n");
+    fprintf(stderr, "\t-M         Compare thread caches and deferred frees, %d threads per CPU.\n", THREADS_PER_CPU);
+    fprintf(stderr, "\t-m <prefix> Write <prefix>-<n>.ppm heap maps at peak use.\n");
+    fprintf(stderr, "\t-O         Check object caches and compare them with mm_malloc.\n");
+    fprintf(stderr, "\t-P         Prefault the heap and reserve each trace's suggested size.\n");
+    fprintf(stderr, "\t-p <rate>  Sample one mm_malloc per <rate> bytes; SIGUSR1 dumps to mm.prof.\n");
+    fprintf(stderr, "\t-R <n>     Release the pages of free blocks of at least <n> bytes.\n");
+    fprintf(stderr, "\t-S         Compare mm_free with and without size-class slabs.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <usec>  Measure heap use on a simulated clock, <usec> per request.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
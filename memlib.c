@@ -2,6 +2,21 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Each simulated heap is a region with its own storage and brk pointer.
+ * The mem_* functions operate on a single default region, which is what
+ * the driver and mm_init use; mem_region_* work on any region.
+ *
+ * A region reserves MAX_HEAP bytes of address space aligned to the 2 MB
+ * huge page size and makes it accessible a huge page at a time as brk
+ * moves up, so the kernel can back the heap with transparent huge pages.
+ * mem_reserve and mem_region_create_at let a caller lay several regions
+ * out in one reservation of its own instead, e.g. one per size class.
+ *
+ * Growing a region is lock free: each caller claims its range of the
+ * heap with one compare-and-swap of brk, so concurrent callers get
+ * disjoint chunks and the heap never passes MAX_HEAP. Shrinking and
+ * resetting a region must not race with anything else.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,28 +25,45 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#define HUGEPAGE (1 << 21)  /* transparent huge page size */
+#define PREFAULT_AHEAD (1 << 18)  /* bytes prefaulted beyond brk */
+
+/* a simulated heap */
+struct mem_region {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    char *commit;     /* end of the accessible part of the storage */
+    char *faulted;    /* end of the part prefaulted by mem_region_sbrk */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t mem_default;  /* region used by the mem_* functions */
+static int use_hugepages = 1;     /* ask for huge pages (mem_hugepages) */
+static int prefault = 0;          /* populate pages ahead of brk */
+
+/* private functions */
+static void region_init(mem_region_t *r, char *lo, size_t size);
+static int region_commit(mem_region_t *r, char *end);
+static void advance(char **p, char *to);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    char *lo;
+
+    if ((lo = (char *)mem_reserve(MAX_HEAP, HUGEPAGE)) == NULL) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    region_init(&mem_default, lo, MAX_HEAP);
 }
 
 /* 
@@ -39,33 +71,26 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_default.start_brk, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    releasing the pages the old heap used
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_region_reset_brk(&mem_default);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap can only be shrunk with mem_region_trim.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&mem_default, incr);
 }
 
 /*
@@ -73,7 +98,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +106,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_default);
 }
 
 /*
@@ -89,7 +114,39 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_heapsize(&mem_default);
+}
+
+/*
+ * mem_resident() - returns the number of heap bytes in physical memory
+ */
+size_t mem_resident()
+{
+    return mem_region_resident(&mem_default);
+}
+
+/*
+ * mem_hugepages - turn transparent huge pages on or off for the default
+ *    region and every region created afterwards. Pages the heap already
+ *    has keep their size until mem_reset_brk releases them.
+ */
+void mem_hugepages(int on)
+{
+    use_hugepages = on;
+    if (mem_default.start_brk != NULL)
+	madvise(mem_default.start_brk, MAX_HEAP, 
+		on ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+}
+
+/*
+ * mem_prefault - turn prefaulting on or off for every region. While it
+ *    is on, mem_sbrk populates the pages of the heap, and PREFAULT_AHEAD
+ *    bytes beyond it, before returning, so the allocator's first writes
+ *    to a new area do not take page faults one page at a time.
+ */
+void mem_prefault(int on)
+{
+    prefault = on;
 }
 
 /*
@@ -99,3 +156,287 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_region_create - make a new, empty simulated heap of MAX_HEAP bytes.
+ *    Returns NULL if the storage cannot be allocated.
+ */
+mem_region_t *mem_region_create(void)
+{
+    mem_region_t *r;
+    char *lo;
+
+    if ((lo = (char *)mem_reserve(MAX_HEAP, HUGEPAGE)) == NULL)
+	return NULL;
+    if ((r = mem_region_create_at(lo, MAX_HEAP)) == NULL)
+	munmap(lo, MAX_HEAP);
+    return r;
+}
+
+/*
+ * mem_region_create_at - make a new, empty simulated heap that grows
+ *    through [lo, lo + size), a range of address space reserved with
+ *    mem_reserve. Returns NULL if the region cannot be allocated.
+ */
+mem_region_t *mem_region_create_at(void *lo, size_t size)
+{
+    mem_region_t *r;
+
+    if ((r = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+    region_init(r, (char *)lo, size);
+    return r;
+}
+
+/*
+ * mem_region_destroy - free a region made by mem_region_create or
+ *    mem_region_create_at, unmapping its whole range
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    munmap(r->start_brk, r->max_addr - r->start_brk);
+    free(r);
+}
+
+/*
+ * mem_reserve - reserve size bytes of address space starting on a
+ *    multiple of align, a power of 2. None of it is accessible until a
+ *    region made on it with mem_region_create_at grows into it. Returns
+ *    NULL if it cannot be mapped.
+ */
+void *mem_reserve(size_t size, size_t align)
+{
+    char *p;
+    size_t lead;
+
+    p = (char *)mmap(NULL, size + align, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+
+    /* trim the mapping to size bytes starting on a multiple of align */
+    lead = (-(uintptr_t)p) & (align - 1);
+    if (lead > 0)
+	munmap(p, lead);
+    munmap(p + lead + size, align - lead);
+    return p + lead;
+}
+
+/*
+ * mem_default_region - return the region used by the mem_* functions
+ */
+mem_region_t *mem_default_region(void)
+{
+    return &mem_default;
+}
+
+/* 
+ * mem_region_sbrk - mem_sbrk for an arbitrary region. Safe to call from
+ *    several threads at once.
+ */
+void *mem_region_sbrk(mem_region_t *r, int incr) 
+{
+    char *old_brk = __atomic_load_n(&r->brk, __ATOMIC_RELAXED);
+    char *new_brk, *faulted;
+
+    /* claim [old_brk, old_brk + incr), retrying if another thread moved
+       brk in the meantime */
+    do {
+	new_brk = old_brk + incr;
+	if (incr < 0 || new_brk > r->max_addr) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&r->brk, &old_brk, new_brk, 1,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (region_commit(r, new_brk) < 0) {
+	/* give the range back unless someone has claimed more since */
+	__atomic_compare_exchange_n(&r->brk, &new_brk, old_brk, 0,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    /* fault in the new area, and some more, in one go */
+    faulted = __atomic_load_n(&r->faulted, __ATOMIC_RELAXED);
+    if (prefault && new_brk > faulted) {
+	char *end = new_brk + PREFAULT_AHEAD;
+
+	if (end > r->commit)
+	    end = r->commit;
+	mem_region_populate(r, faulted, end);
+	advance(&r->faulted, end);
+    }
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_trim - shrink a region by size bytes, but never below its
+ *    first byte, and release the pages above the new brk. Returns the
+ *    new brk, or (void *)-1 if the region is smaller than size. Must not
+ *    race with mem_region_sbrk on the same region.
+ */
+void *mem_region_trim(mem_region_t *r, size_t size)
+{
+    char *old_brk = r->brk;
+
+    if (size > (size_t)(old_brk - r->start_brk)) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    r->brk = old_brk - size;
+    mem_region_decommit(r, r->brk, old_brk);
+    if (r->faulted > r->brk)
+	r->faulted = r->brk;
+    return (void *)r->brk;
+}
+
+/*
+ * mem_region_reset_brk - mem_reset_brk for an arbitrary region
+ */
+void mem_region_reset_brk(mem_region_t *r)
+{
+    mem_region_decommit(r, r->start_brk, r->brk);
+    r->brk = r->start_brk;
+    r->faulted = r->start_brk;
+}
+
+/*
+ * mem_region_populate - fault in every page that overlaps [lo, hi), which
+ *    must lie below brk or within PREFAULT_AHEAD of it
+ */
+void mem_region_populate(mem_region_t *r, void *lo, void *hi)
+{
+    uintptr_t mask = mem_pagesize() - 1;
+    char *start = (char *)((uintptr_t)lo & ~mask);
+    char *end = (char *)(((uintptr_t)hi + mask) & ~mask);
+    volatile char *p;
+
+    if (end > r->commit)
+	end = r->commit;
+    if (end <= start)
+	return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(start, end - start, MADV_POPULATE_WRITE) == 0)
+	return;
+#endif
+    /* older kernels: write every page without changing its contents */
+    for (p = start; p < end; p += mask + 1)
+	*p = *p;
+}
+
+/*
+ * mem_region_decommit - give the physical pages lying wholly inside
+ *    [lo, hi) back to the system. The range stays part of the heap and
+ *    reads back as zeros. Releasing part of a huge page splits it.
+ *    Returns the number of bytes released.
+ */
+size_t mem_region_decommit(mem_region_t *r, void *lo, void *hi)
+{
+    uintptr_t mask = mem_pagesize() - 1;
+    char *start = (char *)(((uintptr_t)lo + mask) & ~mask);
+    char *end = (char *)((uintptr_t)hi & ~mask);
+
+    assert((char *)lo >= r->start_brk && (char *)hi <= r->max_addr);
+    if (end <= start || madvise(start, end - start, MADV_DONTNEED) < 0)
+	return 0;
+    return (size_t)(end - start);
+}
+
+/*
+ * mem_region_resident - returns the number of bytes of a region's heap
+ *    that are in physical memory
+ */
+size_t mem_region_resident(mem_region_t *r)
+{
+    size_t pagesize = mem_pagesize();
+    size_t i, n = (mem_region_heapsize(r) + pagesize - 1) / pagesize;
+    size_t resident = 0;
+    unsigned char *vec;
+
+    if (n == 0 || (vec = (unsigned char *)malloc(n)) == NULL)
+	return 0;
+    if (mincore(r->start_brk, n * pagesize, vec) == 0)
+	for (i = 0; i < n; i++)
+	    resident += vec[i] & 1;
+    free(vec);
+    return resident * pagesize;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region's heap
+ */
+void *mem_region_lo(mem_region_t *r)
+{
+    return (void *)r->start_brk;
+}
+
+/* 
+ * mem_region_hi - return address of the last byte of a region's heap
+ */
+void *mem_region_hi(mem_region_t *r)
+{
+    return (void *)(r->brk - 1);
+}
+
+/*
+ * mem_region_heapsize - returns the size of a region's heap in bytes
+ */
+size_t mem_region_heapsize(mem_region_t *r) 
+{
+    return (size_t)(r->brk - r->start_brk);
+}
+
+/*
+ * region_commit - make the storage accessible up to the huge page
+ *    boundary at or above end. Threads racing here may mprotect the same
+ *    pages twice, which is harmless. Returns -1 if mprotect fails.
+ */
+static int region_commit(mem_region_t *r, char *end)
+{
+    char *commit = __atomic_load_n(&r->commit, __ATOMIC_ACQUIRE);
+    char *target;
+
+    while (commit < end) {
+	target = (char *)(((uintptr_t)end + HUGEPAGE - 1) & 
+			  ~(uintptr_t)(HUGEPAGE - 1));
+	if (target > r->max_addr)
+	    target = r->max_addr;
+	if (mprotect(commit, target - commit, PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+	advance(&r->commit, target);
+	commit = __atomic_load_n(&r->commit, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+/*
+ * advance - atomically raise *p to to, unless it is already higher
+ */
+static void advance(char **p, char *to)
+{
+    char *cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (cur < to && 
+	   !__atomic_compare_exchange_n(p, &cur, to, 1, 
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * region_init - set up an empty region on the reserved range
+ *    [lo, lo + size), which is aligned to a huge page unless it is a
+ *    slice of a bigger reservation. None of it is accessible until
+ *    mem_region_sbrk needs it.
+ */
+static void region_init(mem_region_t *r, char *lo, size_t size)
+{
+    r->start_brk = lo;
+    r->max_addr = lo + size;                /* max legal heap address */
+    r->brk = r->start_brk;                  /* heap is empty initially */
+    r->commit = r->start_brk;               /* nothing is accessible yet */
+    r->faulted = r->start_brk;
+    madvise(r->start_brk, size, 
+	    use_hugepages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+}
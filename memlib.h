@@ -1,5 +1,9 @@
 #include <unistd.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
@@ -7,5 +11,37 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_resident(void);
+void mem_hugepages(int on);
+void mem_prefault(int on);
 size_t mem_pagesize(void);
 
+/*
+ * Independent simulated heaps. Each region has its own storage and brk
+ * pointer; the functions above operate on the default region.
+ */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_region_create(void);
+mem_region_t *mem_region_create_at(void *lo, size_t size);
+void mem_region_destroy(mem_region_t *r);
+mem_region_t *mem_default_region(void);
+void *mem_region_sbrk(mem_region_t *r, int incr);
+void *mem_region_trim(mem_region_t *r, size_t size);
+void mem_region_reset_brk(mem_region_t *r);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+size_t mem_region_heapsize(mem_region_t *r);
+size_t mem_region_decommit(mem_region_t *r, void *lo, void *hi);
+size_t mem_region_resident(mem_region_t *r);
+void mem_region_populate(mem_region_t *r, void *lo, void *hi);
+
+/*
+ * Reserves size bytes of inaccessible address space aligned to align,
+ * for regions made with mem_region_create_at.
+ */
+void *mem_reserve(size_t size, size_t align);
+
+#ifdef __cplusplus
+}
+#endif
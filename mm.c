@@ -12,13 +12,31 @@
  */
 #include <stdbool.h>
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
+#ifndef HAVE_RSEQ
+#define HAVE_RSEQ 0
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "mmprof.h"
+#include "mmguard.h"
+#include "mmlock.h"
+#include "mmslab.h"
+#include "mmgran.h"
 
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
@@ -30,8 +48,23 @@
 #define WSIZE 4         //word and header/footer size (bytes)
 #define DSIZE 8         //double word size
 #define CHUNKSIZE (1<<12)           //extend heap by this amount (bytes)
+#define LASTREM_MAX 256             //largest block served from the last
+                                    //remainder (bytes)
+#define HEAPMAP_WIDTH 64            //pages per row of the mm_heapmap image
+#define MAINT_BATCH 32              //deferred frees drained per lock hold
+#define DECAY_EPOCHS 64             //steps of the dirty page decay curve
+#define CACHE_MAX 256               //largest block size kept by mm_caches
+#define CACHE_CLASSES (CACHE_MAX / DSIZE - 1)   //one per block size from 16
+#define CACHE_DEPTH 32              //blocks per size in one cache
+#define CACHE_BATCH 16              //blocks carved from each refill chunk
+#define CACHE_MIN 4                 //smallest capacity of a thread's stack
+#define CACHE_GC_OPS 4096           //thread cache operations between gcs
+#define CACHE_LEASE 4096            //bytes a thread charges to the cap at once
+#define CACHE_LIMIT (1 << 20)       //default cap on bytes in thread caches
+#define EPOCH_BATCH 64              //deferred frees between epoch advances
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 //pack a size and allocated bit into a word
 #define PACK(size, alloc) ((size) | (alloc))
@@ -44,6 +77,13 @@
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+//allocated block is recorded by the heap profiler (mmprof.c)
+#define SAMPLED 0x2
+//free block whose whole pages have been given back with mem_region_decommit
+#define DECOMMITTED 0x2
+//allocated block belongs to a handle and may be moved by mm_compact
+#define MOVABLE 0x4
+
 //given block ptr bp, compute address of its header and footer
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -52,13 +92,210 @@
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+//given a free block ptr bp, its free list links (see freeblock_t) and the
+//free blocks they lead to in heap h
+#define FREEBLK(bp) ((freeblock_t *)(bp))
+#define FREE_OFF(h, bp) ((unsigned int)((char *)(bp) - (h)->base))
+#define FREE_BLKP(h, off) ((h)->base + (off))
+
+//offset of heap h's wilderness, the free block under the epilogue, or 0
+#define WILDERNESS(h) ((h)->free_tail != 0 && \
+    GET_SIZE(HDRP(NEXT_BLKP(FREE_BLKP(h, (h)->free_tail)))) == 0 ? \
+    (h)->free_tail : 0)
+
+//allocator event counters, see mm_stats() in mm.h
+#ifndef MM_STATS
+#define MM_STATS 0
+#endif
+
+#if MM_STATS
+static mm_stats_t stats;
+#define STAT_INC(field) (stats.field++)
+#define STAT_ADD(field, n) (stats.field += (n))
+#define STAT_SEARCH(n) stat_search(n)
+static void stat_search(unsigned long n);
+#else
+#define STAT_INC(field)
+#define STAT_ADD(field, n)
+#define STAT_SEARCH(n) ((void)(n))
+#endif
+
+//state of one heap; mm_malloc and friends use default_heap
+struct mm_heap {
+    mem_region_t *mem;              //simulated memory the heap grows into
+    char *heap_listp;               //first block pointer
+    char *base;                     //start of mem, where free list
+                                    //offsets count from
+    unsigned int free_list;         //offset of the first free block, 0
+                                    //if there are none
+    unsigned int free_tail;         //offset of the last free block
+    size_t fit_bound;               //no free block but the wilderness is
+                                    //bigger than this
+    unsigned int rover;             //offset of the free block the next
+                                    //search starts at, 0 past the last
+    unsigned int last_rem;          //offset of what is left of the block
+                                    //last split for a small request, 0
+                                    //if none
+    char *last_bp;                  //block most recently touched, for mm_check_last
+};
+
 //global variables
-static char *heap_listp = 0;        //first block pointer
-static char *rover;             //next block pointer
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
+static mm_heap_t default_heap;
+static void *default_malloc(size_t size);
+static int heap_init(mm_heap_t *h);
+static void *extend_heap(mm_heap_t *h, size_t words);
+static void place(mm_heap_t *h, void *bp, size_t asize);
+static void *find_fit(mm_heap_t *h, size_t asize);
+static void *coalesce(mm_heap_t *h, void *bp);
+static void list_insert(mm_heap_t *h, char *bp);
+static void list_link(mm_heap_t *h, char *bp, unsigned int prev,
+                      unsigned int next);
+static void list_remove(mm_heap_t *h, char *bp);
+static int check_block(mm_heap_t *h, void *bp);
+static void heapmap_add(size_t (*bytes)[3], char *start, char *end, int c);
+static char *slide_block(mm_heap_t *h, char *bp, char *next);
+static int grow_handles(void);
+static size_t trim_heap(mm_heap_t *h, size_t pad);
+static size_t release_block(mm_heap_t *h, char *bp);
+static int drain_deferred(mm_heap_t *h, int max);
+static void *maint_main(void *arg);
+static void decay_tick(mm_heap_t *h);
+static void decay_purge(mm_heap_t *h, size_t limit);
+static unsigned long decay_clock_mono(void);
+
+//handle table for relocatable blocks; a free entry has bp == NULL and
+//keeps the next free handle in pins. The table moves when it grows, so
+//it is only touched under heap_lock once other threads may run
+typedef struct handle {
+    char *bp;                       //block holding the handle's data
+    unsigned int pins;              //outstanding mm_hlock calls
+} handle_t;
+
+static handle_t *handles;           //entry i is handle i + 1
+static unsigned int nhandles;
+static unsigned int free_handles;   //first free handle, 0 if none
+
+//background maintenance of the default heap, see mm_maint_start
+static volatile int maint_on;       //mm_malloc/mm_free must take heap_lock
+static mm_lock_t heap_lock = MM_LOCK_INITIALIZER;
+static pthread_t maint_thread;
+static long maint_period;           //nanoseconds between passes
+static long maint_budget;           //nanoseconds of work per pass
+static void *deferred;              //frees queued by mm_free, linked
+                                    //through their first payload word
+
+static size_t release_min;          //mm_free releases the pages of free
+                                    //blocks this big, 0 for never
+static size_t reserve_pad;          //free bytes trimming leaves at the top
+                                    //of the default heap, see mm_reserve
+
+//decay of the dirty free pages of the default heap, see mm_decay
+static unsigned long decay_us;      //decay time, 0 if off
+static unsigned long (*decay_clock)(void) = decay_clock_mono;
+static unsigned long decay_epoch;   //start of the current epoch
+static size_t decay_freed[DECAY_EPOCHS];    //bytes freed per epoch, [0] is
+                                            //the current one
+static size_t decay_dirty;          //upper bound on the dirty free bytes
+
+//caches of small free blocks in front of the default heap, see mm_caches.
+//Cached blocks stay allocated in the heap; stack i of a cache holds
+//blocks of (i + 2) * DSIZE bytes.
+typedef struct cache {
+    unsigned long count[CACHE_CLASSES];     //blocks in each stack
+    void *slot[CACHE_CLASSES][CACHE_DEPTH];
+} __attribute__((aligned(64))) cache_t;
+
+static volatile int cache_mode;     //MM_CACHES_*, mm_malloc/mm_free must
+                                    //take heap_lock unless it is 0
+static cache_t *cpu_caches;         //one per configured CPU
+static int ncpus;
+static unsigned int cache_gen;      //bumped by mm_init, which empties the
+                                    //caches of every thread
+
+//a thread's cache, which sizes each stack to how much it is used: a
+//stack that runs empty or full grows, one whose blocks sit unused
+//between two gcs shrinks and gives half of them back to the heap
+typedef struct tcache {
+    cache_t c;
+    unsigned int max[CACHE_CLASSES];        //capacity of each stack
+    unsigned int low[CACHE_CLASSES];        //fewest blocks since the last gc
+    unsigned int misses[CACHE_CLASSES];     //empty or full since last gc
+    size_t bytes;                           //bytes of blocks in the cache
+    size_t charged;                         //bytes charged to cache_limit
+    unsigned long ops;                      //pushes and pops, for the gc
+    unsigned int gen;                       //cache_gen when last set up
+    int exited;                             //flushed for good at exit
+} tcache_t;
+
+static __thread tcache_t thread_cache;
+static pthread_key_t thread_cache_key;      //flushes a thread's cache
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;  //at exit
+static size_t cache_limit = CACHE_LIMIT;    //cap on bytes in thread caches
+static size_t cache_charged;                //bytes charged by all of them
+
+static void *cache_malloc(size_t size);
+static void *cache_refill(size_t asize, int n);
+static int cache_push(void *bp);
+static void cache_flush(cache_t *c);
+static tcache_t *my_thread_cache(void);
+static void thread_cache_gc(tcache_t *t);
+static void thread_cache_flush(tcache_t *t);
+static void thread_cache_exit(void *arg);
+static void thread_cache_key_init(void);
+static int cache_charge(tcache_t *t, size_t size);
+static void cache_uncharge(tcache_t *t);
+static void *cpu_pop(int cls);
+static int cpu_push(int cls, void *bp);
+static int cpu_caches_init(void);
+
+//blocks retired by one thread, kept out of the blocks themselves since
+//readers in older epochs may still be looking at every byte of them
+typedef struct retired {
+    void **bps;
+    unsigned int n;
+    unsigned int max;
+} retired_t;
+
+//epoch-based reclamation, see mm_free_deferred. A record publishes the
+//epoch its thread entered a critical section in and holds the blocks the
+//thread retired in the last three epochs. Records are never unlinked; a
+//thread that exits gives its record, with whatever is still in limbo, to
+//the next thread that needs one.
+typedef struct epoch_rec {
+    unsigned long state;            //epoch << 1 | 1 inside a critical
+                                    //section, 0 outside
+    int owned;                      //a thread or mm_epoch_flush holds it
+    unsigned int depth;             //nesting of mm_epoch_enter calls
+    unsigned int retired;           //mm_free_deferred calls since the last
+                                    //advance
+    retired_t limbo[3];             //blocks retired in epoch e, by e % 3
+    unsigned long limbo_epoch[3];
+    retired_t ready;                //blocks that are safe to free
+    struct epoch_rec *next;
+} __attribute__((aligned(64))) epoch_rec_t;
+
+static unsigned long epoch_global;  //the current epoch
+static epoch_rec_t *epoch_recs;     //every record, newest first
+static __thread epoch_rec_t *my_epoch_rec;
+static pthread_key_t epoch_key;             //gives up a thread's record
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;   //at exit
+
+static epoch_rec_t *my_epoch(void);
+static int epoch_advance(void);
+static void epoch_reclaim(epoch_rec_t *r);
+static void epoch_ready(epoch_rec_t *r, int i);
+static void retired_add(retired_t *l, void *bp);
+static size_t epoch_collect(epoch_rec_t *r);
+static void epoch_exit(void *arg);
+static void epoch_key_init(void);
+
+//reports a failed heap check and makes the checker return 0
+#define CHECK(cond, bp, msg) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "mm_check: %s (block %p)\n", (msg), (void *)(bp)); \
+        return 0; \
+    } \
+} while(0)
 
 // Header Node. Contains a single field which is the packed size 
 // and is allocated
@@ -72,11 +309,14 @@ typedef struct footer {
     size_t size_alloc;
 } footer_t;
 
-// FreeBlock Node. Contained within unallocated blocks. Can be used to implement
-// an explicit free list.
+// FreeBlock Node. Contained within unallocated blocks, linking them into
+// the heap's explicit free list. The links are 32-bit offsets from the
+// start of the heap's region rather than pointers, so both fit in the 8
+// payload bytes of a minimum size block; offset 0, the padding word, is
+// never a block and ends the list.
 typedef struct freeblock {
-    struct freeblock *next;
-    struct freeblock *prev;
+    unsigned int next;
+    unsigned int prev;
 } freeblock_t;
 
 void put_footer(footer_t *f, size_t size, bool alloc) {
@@ -147,43 +387,289 @@ header_t *get_freeblock_header(freeblock_t *freeblock) {
  * creates empty free list, creates initial free block through heap extension
  */
 int mm_init(void) {
-    //code is based off of Computer Systems Textbook, Section 9.9
-    //Dynamic Memory Allocation page 894, figure 9.44
+    epoch_rec_t *r;
 
-    //create the intial empty heap
-    if((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1) {
-        return -1;
+    if(heap_lock.name == NULL) {
+        mm_lock_init(&heap_lock, "heap");
     }
-    PUT(heap_listp, 0);
-    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));
-    heap_listp += (2 * WSIZE);
+    mm_prof_reset();
+    mm_guard_reset();
+    mm_slab_reset();
+    mm_gran_reset();
+    if(cpu_caches) {
+        memset(cpu_caches, 0, ncpus * sizeof(cache_t));
+    }
+    cache_gen++;
+    cache_charged = 0;
+    for(r = epoch_recs; r != NULL; r = r->next) {
+        r->limbo[0].n = r->limbo[1].n = r->limbo[2].n = 0;
+        r->ready.n = 0;
+    }
+    nhandles = 0;
+    free_handles = 0;
 
-    rover = heap_listp;
+#if MM_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
 
-    //extend the empty heap with a free block of CHUNKSIZE bytes
-    if(extend_heap(CHUNKSIZE / WSIZE) == NULL) {
-        return -1;
+    memset(decay_freed, 0, sizeof(decay_freed));
+    decay_dirty = 0;
+    reserve_pad = 0;
+    decay_epoch = decay_clock();
+
+    default_heap.mem = mem_default_region();
+    return heap_init(&default_heap);
+}
+
+/*
+ * mm_malloc, mm_free and mm_realloc work on the default heap, which
+ * lives in memlib's default region, apart from the blocks that
+ * mm_guard samples into its guarded pool (mmguard.c), the small
+ * objects served by the size-class slabs (mmslab.c) and the medium ones
+ * served by the granule bitmaps (mmgran.c). Both entry points that can
+ * allocate note where they were called from, which is where the heap
+ * profiler starts a sample's stack.
+ */
+void *mm_malloc(size_t size) {
+    mm_prof_caller = __builtin_return_address(0);
+    return default_malloc(size);
+}
+
+//mm_malloc without noting the caller, for mm_realloc
+static void *default_malloc(size_t size) {
+    void *bp;
+    long n;
+
+    //with other threads about, a lost decrement only delays a sample,
+    //but taking one needs the lock and a countdown that is still due
+    if(!maint_on && !cache_mode) {
+        if(--mm_guard_countdown < 0 && (bp = mm_guard_malloc(size)) != NULL) {
+            return bp;
+        }
+    } else {
+        n = __atomic_load_n(&mm_guard_countdown, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&mm_guard_countdown, n, __ATOMIC_RELAXED);
+        if(n < 0) {
+            mm_lock(&heap_lock);
+            bp = mm_guard_countdown < 0 ? mm_guard_malloc(size) : NULL;
+            mm_unlock(&heap_lock);
+            if(bp != NULL) {
+                return bp;
+            }
+        }
     }
-    return 0;
+    //size - 1 wraps for 0, which the heap turns down
+    if(mm_slab_on && size - 1 < MM_SLAB_MAX) {
+        if(!maint_on && !cache_mode) {
+            bp = mm_slab_malloc(size);
+        } else {
+            mm_lock(&heap_lock);
+            bp = mm_slab_malloc(size);
+            mm_unlock(&heap_lock);
+        }
+        if(bp != NULL) {
+            return bp;
+        }
+    }
+    if(mm_gran_on && size - MM_GRAN_MIN <= MM_GRAN_MAX - MM_GRAN_MIN) {
+        if(!maint_on && !cache_mode) {
+            bp = mm_gran_malloc(size);
+        } else {
+            mm_lock(&heap_lock);
+            bp = mm_gran_malloc(size);
+            mm_unlock(&heap_lock);
+        }
+        if(bp != NULL) {
+            return bp;
+        }
+    }
+    if(cache_mode && (bp = cache_malloc(size)) != NULL) {
+        return bp;
+    }
+    if(!maint_on && !cache_mode) {
+        return mm_heap_malloc(&default_heap, size);
+    }
+    mm_lock(&heap_lock);
+    bp = mm_heap_malloc(&default_heap, size);
+    mm_unlock(&heap_lock);
+    return bp;
+}
+
+void mm_free(void *bp) {
+    void *head;
+
+    if(MM_GUARD_OWNS(bp)) {
+        if(!maint_on && !cache_mode) {
+            mm_guard_free(bp);
+            return;
+        }
+        mm_lock(&heap_lock);
+        mm_guard_free(bp);
+        mm_unlock(&heap_lock);
+        return;
+    }
+    if(MM_SLAB_OWNS(bp)) {
+        if(!maint_on && !cache_mode) {
+            mm_slab_free(bp);
+            return;
+        }
+        mm_lock(&heap_lock);
+        mm_slab_free(bp);
+        mm_unlock(&heap_lock);
+        return;
+    }
+    if(MM_GRAN_OWNS(bp)) {
+        if(!maint_on && !cache_mode) {
+            mm_gran_free(bp);
+            return;
+        }
+        mm_lock(&heap_lock);
+        mm_gran_free(bp);
+        mm_unlock(&heap_lock);
+        return;
+    }
+    if(cache_mode && bp != NULL && cache_push(bp)) {
+        return;
+    }
+    if(!maint_on && !cache_mode) {
+        mm_heap_free(&default_heap, bp);
+        return;
+    }
+    if(!maint_on) {
+        mm_lock(&heap_lock);
+        mm_heap_free(&default_heap, bp);
+        mm_unlock(&heap_lock);
+        return;
+    }
+    //leave the free itself to the maintenance thread
+    if(bp == NULL) {
+        return;
+    }
+    head = __atomic_load_n(&deferred, __ATOMIC_RELAXED);
+    do {
+        *(void **)bp = head;
+    } while(!__atomic_compare_exchange_n(&deferred, &head, bp, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void *mm_realloc(void *oldptr, size_t size) {
+    void *bp;
+    size_t oldsize;
+
+    mm_prof_caller = __builtin_return_address(0);
+
+    //a guarded block always moves, wherever its new copy ends up
+    if(MM_GUARD_OWNS(oldptr)) {
+        if(size == 0) {
+            mm_free(oldptr);
+            return NULL;
+        }
+        if((bp = default_malloc(size)) != NULL) {
+            oldsize = mm_guard_size(oldptr);
+            memcpy(bp, oldptr, size < oldsize ? size : oldsize);
+            mm_free(oldptr);
+        }
+        return bp;
+    }
+    //so does a slab object, unless it still fits
+    if(MM_SLAB_OWNS(oldptr)) {
+        oldsize = MM_SLAB_SIZE(MM_SLAB_CLASS(oldptr));
+        if(size != 0 && size <= oldsize) {
+            return oldptr;
+        }
+        if(size == 0) {
+            mm_free(oldptr);
+            return NULL;
+        }
+        if((bp = default_malloc(size)) != NULL) {
+            memcpy(bp, oldptr, size < oldsize ? size : oldsize);
+            mm_free(oldptr);
+        }
+        return bp;
+    }
+    //and a granule bitmap object
+    if(MM_GRAN_OWNS(oldptr)) {
+        if(!maint_on && !cache_mode) {
+            oldsize = mm_gran_size(oldptr);
+        } else {
+            mm_lock(&heap_lock);
+            oldsize = mm_gran_size(oldptr);
+            mm_unlock(&heap_lock);
+        }
+        if(size != 0 && size <= oldsize) {
+            return oldptr;
+        }
+        if(size == 0) {
+            mm_free(oldptr);
+            return NULL;
+        }
+        if((bp = default_malloc(size)) != NULL) {
+            memcpy(bp, oldptr, oldsize);
+            mm_free(oldptr);
+        }
+        return bp;
+    }
+    if(!maint_on && !cache_mode) {
+        return mm_heap_realloc(&default_heap, oldptr, size);
+    }
+    mm_lock(&heap_lock);
+    bp = mm_heap_realloc(&default_heap, oldptr, size);
+    mm_unlock(&heap_lock);
+    return bp;
+}
+
+/*
+ * mm_heap_create - makes an independent heap with its own simulated
+ * memory region. Returns NULL if the region or heap cannot be set up.
+ */
+mm_heap_t *mm_heap_create(void) {
+    mm_heap_t *h;
+
+    if((h = malloc(sizeof(mm_heap_t))) == NULL) {
+        return NULL;
+    }
+    if((h->mem = mem_region_create()) == NULL) {
+        free(h);
+        return NULL;
+    }
+    if(heap_init(h) < 0) {
+        mm_heap_destroy(h);
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ * mm_heap_destroy - releases a heap made by mm_heap_create together with
+ * every block still allocated from it
+ */
+void mm_heap_destroy(mm_heap_t *h) {
+    mm_prof_forget(mem_region_lo(h->mem), mem_region_hi(h->mem));
+    mem_region_destroy(h->mem);
+    free(h);
 }
 
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * mm_heap_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
-void *mm_malloc(size_t size) {
+void *mm_heap_malloc(mm_heap_t *h, size_t size) {
     //code is based off of Computer Systems Textbook, Section 9.9
     //Dynamic Memory Allocation page 897, figure 9.47
     size_t asize;       //adjusted block size
     size_t extendsize;      //amount to extend heap if no fit
+    unsigned int top;       //offset of the wilderness, 0 if none
     char *bp;
 
-    //ignore fake requests
-    if(size == 0) {
+    //ignore fake requests, and ones whose block memlib could not grow the
+    //heap by in one int increment
+    if(size == 0 || size > INT_MAX - 2 * DSIZE) {
         return NULL;
     }
+    STAT_INC(mallocs);
+    if(decay_us && h == &default_heap) {
+        decay_tick(h);
+    }
 
     //adjust block size to include overhead and alignment reqs
     if(size <= DSIZE) {
@@ -192,269 +678,1838 @@ void *mm_malloc(size_t size) {
         asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
     }
 
-    //search the free list for a fit
-    if((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
-        return bp;
+    //small requests are carved off the last remainder while it lasts, so
+    //blocks allocated together end up next to each other; otherwise
+    //search the free list for a fit, and before growing the heap, try
+    //again with the frees the maintenance thread has not done yet
+    if(asize <= LASTREM_MAX && h->last_rem != 0 &&
+       asize <= GET_SIZE(HDRP(FREE_BLKP(h, h->last_rem)))) {
+        STAT_INC(lastrem_hits);
+        bp = FREE_BLKP(h, h->last_rem);
+    } else if((bp = find_fit(h, asize)) == NULL &&
+       (h != &default_heap || drain_deferred(h, -1) == 0 ||
+        (bp = find_fit(h, asize)) == NULL)) {
+        //no fit found get more memory and place the block; a wilderness
+        //that is too small is grown in place by what it lacks
+        top = WILDERNESS(h);
+        extendsize = top ? asize - GET_SIZE(HDRP(FREE_BLKP(h, top))) :
+            MAX(asize, CHUNKSIZE);
+        if((bp = extend_heap(h, extendsize / WSIZE)) == NULL) {
+            return NULL;
+        }
+    }
+    if(GET(HDRP(bp)) & DECOMMITTED) {
+        STAT_INC(recommits);
     }
+    place(h, bp, asize);
+    h->last_bp = bp;
 
-    //no fit found get more memory and place the block
-    extendsize = MAX(asize, CHUNKSIZE);
-    if((bp = extend_heap(extendsize / WSIZE)) == NULL) {
-        return NULL;
+    //let the heap profiler sample about once every N bytes
+    if((mm_prof_countdown -= (long)size) < 0 && mm_prof_sample(bp, size)) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED);
+        PUT(FTRP(bp), GET(FTRP(bp)) | SAMPLED);
     }
-    place(bp, asize);
     return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_heap_free - Freeing a block does nothing.
  * The most recently allocated block is freed and then
  * the adjacent blocks are merged.
  */
-void mm_free(void *bp) {
+void mm_heap_free(mm_heap_t *h, void *bp) {
     //code is based off of Computer Systems Textbook, Section 9.9
     //Dynamic Memory Allocation page 896, figure 9.46
     if(bp == 0) {
         return;
     }
+    STAT_INC(frees);
     size_t size = GET_SIZE(HDRP(bp));
 
+    if(GET(HDRP(bp)) & SAMPLED) {
+        mm_prof_free(bp);
+    }
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
+    h->last_bp = bp = coalesce(h, bp);
+
+    //don't keep the pages of a large free block in memory, unless it is
+    //the top of the heap, which the next extend_heap will grow into
+    if(release_min && GET_SIZE(HDRP(bp)) >= release_min &&
+       GET_SIZE(HDRP(NEXT_BLKP(bp)))) {
+        release_block(h, bp);
+    }
+    if(decay_us && h == &default_heap) {
+        decay_freed[0] += size;
+        decay_dirty += size;
+        decay_tick(h);
+    }
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_heap_realloc - Implemented simply in terms of mm_malloc and mm_free
  * Following the limits addressed in the handout, the pointer to the
  * allocated region of a certain size bytes is returned.
  */
-void *mm_realloc(void *oldptr, size_t size) {
+void *mm_heap_realloc(mm_heap_t *h, void *oldptr, size_t size) {
     // Basic Implementation with elements from Computer Systems Textbook and Assignment Handout
-    void *old = oldptr;
     void *newptr;
     size_t copy;
-    
-    //gets a new pointer block
-    newptr = mm_malloc(size);
-    if (newptr == NULL){
-      return NULL;
-    }
+
+    STAT_INC(reallocs);
 
     //call the free method if the size is 0
     if(size == 0){
-        mm_free(oldptr);
+        mm_heap_free(h, oldptr);
         return 0;
     }
 
-    //copy over the old data
-    copy = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
+    //gets a new pointer block
+    newptr = mm_heap_malloc(h, size);
+    if (newptr == NULL){
+      return NULL;
+    }
+    if (oldptr == NULL){
+      return newptr;
+    }
+
+    //copy over the old data, at most the old block's payload
+    copy = GET_SIZE(HDRP(oldptr)) - DSIZE;
     if (size < copy){
       copy = size;
     }
 
     memcpy(newptr, oldptr, copy);
-    mm_free(oldptr);
+    mm_heap_free(h, oldptr);
     return newptr;
 }
 
 /*
- * mm_check - Scans the heap for inconsistencies, should exit with an assert
- * if an inconsistency is found.
+ * mm_halloc - allocates a relocatable block of size bytes in the default
+ * heap and returns its handle, or 0 on failure. The block's first DSIZE
+ * bytes hold the handle number so mm_compact can update the table when it
+ * moves the block; the data starts after them.
  */
+mm_handle_t mm_halloc(size_t size) {
+    mm_handle_t id = 0;
+    char *bp;
 
-static freeblock_t *freeHead;
-static header_t *firstHead;
-static int num_freeblocks;
-
-void mm_check() {
-    //code is from discussion section
-    header_t *h = firstHead;
-    bool prev_alloc = !get_alloc(h);
-
-    //assert prologue header is correct
-    assert(get_below_header(h) == (header_t *) mem_heap_lo());
-
-    //block level invariants
-    while(get_size(h > 0)) {
-        footer_t *f = get_footer(h);
-        size_t size = get_size(h);
-        //assert header and footer have the same size and allocation
-        assert(get_size_footer(f) == size);
-        //assert header and footer match
-        assert((void *)f - size + sizeof(footer_t) == h);
-        //assert no contiguous free blocks
-        assert(prev_alloc != 0 && get_alloc(h) != 0);
-        //assert size is aligned
-        assert(size % ALIGNMENT == 0);
-        assert((long) get_payload(h) % ALIGNMENT == 0);
+    //straight from the heap, since a slab, span or guard object has no
+    //tags to mark MOVABLE, and marked before mm_compact can see it
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
+    }
+    if((free_handles != 0 || grow_handles() == 0) &&
+       (bp = mm_heap_malloc(&default_heap, size + DSIZE)) != NULL) {
+        id = free_handles;
+        free_handles = handles[id - 1].pins;
+        handles[id - 1].bp = bp;
+        handles[id - 1].pins = 0;
+
+        PUT(bp, id);
+        PUT(HDRP(bp), GET(HDRP(bp)) | MOVABLE);
+        PUT(FTRP(bp), GET(FTRP(bp)) | MOVABLE);
+    }
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
+    }
+    return id;
+}
 
-        //assert header/footer stay inside the heap
-        assert(h > mem_heap_lo() && h < mem_heap_hi());
+/*
+ * mm_hlock - pins a handle's block and returns its data. The pointer
+ * stays valid until the matching mm_hunlock.
+ */
+void *mm_hlock(mm_handle_t id) {
+    char *bp;
 
-        prev_alloc = get_alloc(h);
-        h = get_above_header(h);
+    if(!maint_on && !cache_mode) {
+        handles[id - 1].pins++;
+        return handles[id - 1].bp + DSIZE;
     }
+    mm_lock(&heap_lock);
+    handles[id - 1].pins++;
+    bp = handles[id - 1].bp;
+    mm_unlock(&heap_lock);
+    return bp + DSIZE;
+}
 
-    //assert epilogue is correct
-    assert((void *) get_above_header(h) == mem_heap_hi() - 7);
-
-    freeblock_t *fb = freeHead;
-    freeblock_t *prev = freeHead->prev;
-    freeblock_t *next = freeHead->next;
-    int count = 0;
+/*
+ * mm_hunlock - drops one pin, letting mm_compact move the block again
+ * once none are left
+ */
+void mm_hunlock(mm_handle_t id) {
+    if(!maint_on && !cache_mode) {
+        handles[id - 1].pins--;
+        return;
+    }
+    mm_lock(&heap_lock);
+    handles[id - 1].pins--;
+    mm_unlock(&heap_lock);
+}
 
-    //list level invariants
-    while(fb) {
-        count++;
-        h = get_freeblock_header(fb);
-        //assert block is actually free
-        assert(!get_alloc(h));
-        if(prev) {
-            assert(prev->next == fb);
-        }
-        if(next) {
-            assert(next->prev == fb);
-        }
-        assert(fb > mem_heap_lo() && fb < mem_heap_hi());
+/*
+ * mm_hfree - frees a handle and its block. The block is freed at once
+ * even while the maintenance thread runs: queued, it would stay MOVABLE
+ * with the queue link over its handle number.
+ */
+void mm_hfree(mm_handle_t id) {
+    handle_t *e;
 
-        fb = next;
+    if(id == 0) {
+        return;
     }
-
-    //check for backwards cycle
-    fb = prev;
-    while(fb) {
-        fb = fb->prev;
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
+    }
+    e = &handles[id - 1];
+    mm_heap_free(&default_heap, e->bp);
+    e->bp = NULL;
+    e->pins = free_handles;
+    free_handles = id;
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
     }
+}
 
-    //assert number of free blocks in the list  = number of free blocks
-    assert(count == num_freeblocks);
+/*
+    The grow_handles function doubles the handle table and puts the new
+    entries on the free handle list. Returns 0, or -1 if out of memory.
+*/
+static int grow_handles(void) {
+    unsigned int id, n = nhandles ? 2 * nhandles : 64;
+    handle_t *t = realloc(handles, n * sizeof(handle_t));
 
+    if(t == NULL) {
+        return -1;
+    }
+    handles = t;
+    for(id = n; id > nhandles; id--) {
+        handles[id - 1].bp = NULL;
+        handles[id - 1].pins = free_handles;
+        free_handles = id;
+    }
+    nhandles = n;
     return 0;
 }
 
 /*
-    The extend_heap function ensures that additional heap space
-    is retrieved from the memory and that the requested size is
-    rounded properly
-*/
-static void *extend_heap(size_t words) {
-    //code is borrowed from Computer Systems Textbook, Section 9.9
-    //Dynamic Memory Allocation page 894, figure 9.45
-
-    char *bp;
+ * mm_compact - slides every unpinned handle block down over the free
+ * block before it, so free space collects above the fixed blocks and at
+ * the top of the heap, then gives the free block at the top back to
+ * memlib. Returns the number of bytes the heap shrank by.
+ */
+size_t mm_compact(void) {
+    mm_heap_t *h = &default_heap;
+    char *bp, *next;
     size_t size;
 
-    //allocate an even number of words to maintain alignment
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if((long) (bp = mem_sbrk(size)) == -1) {
-        return NULL;
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
     }
+    //blocks still queued by mm_free look allocated, and one that was a
+    //handle block looks MOVABLE, so do those frees first
+    drain_deferred(h, -1);
+    for(bp = NEXT_BLKP(h->heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        //after a slide the free block is right above the moved one, so
+        //keep sliding blocks down into it until a fixed block stops it
+        while(!GET_ALLOC(HDRP(bp))) {
+            next = NEXT_BLKP(bp);
+            if(!(GET(HDRP(next)) & MOVABLE) ||
+               handles[GET(next) - 1].pins > 0) {
+                break;
+            }
+            bp = slide_block(h, bp, next);
+            bp = NEXT_BLKP(bp);
+        }
+    }
+    h->last_bp = NULL;
+    size = trim_heap(h, reserve_pad);
 
-    //initialize free block header/footer and the epilogue header
-    PUT(HDRP(bp), PACK(size, 0));       /* free block header */
-    PUT(FTRP(bp), PACK(size, 0));       /* free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));       /* new epilogue header */
-
-    //coalesce if the previous block was free
-    return coalesce(bp);
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
+    }
+    return size;
 }
 
 /*
-    The place function will split the block if the remainder
-    of the block after splitting is still greater than or 
-    equal to the minimum block size
+    The slide_block function moves the allocated block next down to start
+    where the free block bp starts, and leaves the free space above it,
+    merged with whatever free block follows. Returns the moved block.
 */
-static void place(void *bp, size_t asize) {
-    //code is based off of Computer Systems Textbook, Section 9.9
-    //Dynamic Memory Allocation page 920
+static char *slide_block(mm_heap_t *h, char *bp, char *next) {
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t nsize = GET_SIZE(HDRP(next));
+    char *rest;
+
+    list_remove(h, bp);
+    memmove(HDRP(bp), HDRP(next), nsize);
+    handles[GET(bp) - 1].bp = bp;
+    if(GET(HDRP(bp)) & SAMPLED) {
+        mm_prof_move(next, bp);
+    }
 
-    size_t csize = GET_SIZE(HDRP(bp));
+    rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(fsize, 0));
+    PUT(FTRP(rest), PACK(fsize, 0));
+    coalesce(h, rest);
+    return bp;
+}
 
-    if((csize - asize) >= (DSIZE * 2)) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, 0));
-        PUT(FTRP(bp), PACK(csize - asize, 0));
+/*
+ * mm_reserve - grows the default heap until its top free block holds at
+ * least bytes bytes and faults that block's pages in now, so that the
+ * requests that use it later don't take the page faults. Trimming leaves
+ * that much free at the top of the heap from then on. Returns 0, or -1
+ * if the heap cannot grow that far.
+ */
+int mm_reserve(size_t bytes) {
+    mm_heap_t *h = &default_heap;
+    char *last;
+    size_t have = 0;
+    int rc = 0;
+
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
+    }
+    bytes = MAX(2 * DSIZE, DSIZE * ((bytes + DSIZE - 1) / DSIZE));
+    last = PREV_BLKP((char *)mem_region_hi(h->mem) + 1);
+    if(last != h->heap_listp && !GET_ALLOC(HDRP(last))) {
+        have = GET_SIZE(HDRP(last));
+    }
+    if(have < bytes) {
+        last = extend_heap(h, MAX(2 * DSIZE, bytes - have) / WSIZE);
+    }
+    if(last != NULL) {
+        mem_region_populate(h->mem, last, FTRP(last));
+        reserve_pad = bytes;
     } else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize , 1));
+        rc = -1;
     }
 
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
+    }
+    return rc;
 }
 
-/*  The find_fit function searches for a free block that fits.
-    The first while loop starts from the last search and check for the next
-    free block that fits and the second while loop searches from the start
-    until the last search.
-*/
-static void *find_fit(size_t asize) {
-    //code is based off of Computer Systems Textbook, Section 9.9
-    //Dynamic Memory Allocation page 920
-
-    /* Next fit search */
-    char * oldrover = rover;
-    void *bp;
+/*
+ * mm_maint_start - moves heap maintenance of the default heap off the
+ * mm_free path. A thread wakes every period_us microseconds and, for at
+ * most duty percent of the period, frees the blocks mm_free queued,
+ * coalescing them, and trims the free block at the top of the heap down
+ * to CHUNKSIZE. Returns 0, or -1 if the thread cannot be started.
+ */
+int mm_maint_start(unsigned int period_us, unsigned int duty) {
+    if(maint_on || period_us == 0 || duty == 0 || duty > 100) {
+        return -1;
+    }
+    maint_period = period_us * 1000L;
+    maint_budget = maint_period / 100 * duty;
+    maint_on = 1;
+    if(pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+        maint_on = 0;
+        return -1;
+    }
+    return 0;
+}
 
-    //searches starting at last allocated block
-    while(GET_SIZE(HDRP(rover))) {
-        if(!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover)))) {
-            return rover;
-        }
-        rover = NEXT_BLKP(rover);
+/*
+ * mm_maint_stop - stops the maintenance thread and does the frees it
+ * left queued
+ */
+void mm_maint_stop(void) {
+    if(!maint_on) {
+        return;
     }
+    maint_on = 0;
+    pthread_join(maint_thread, NULL);
+
+    //a thread that saw maint_on before it was cleared may still be
+    //inside the heap, so the lock is taken whatever the mode now is
+    mm_lock(&heap_lock);
+    drain_deferred(&default_heap, -1);
+    mm_unlock(&heap_lock);
+}
 
-    bp = heap_listp;
-    //searches starting from the beginning to the last search
-    while(bp < oldrover) {
-        if(!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-            return bp;
+/*
+    The maint_main function is the maintenance thread. Each pass drains
+    the deferred frees in batches, dropping the heap lock between batches
+    so mm_malloc never waits for more than one, until the queue is empty
+    or the pass has used its budget, then trims the heap and sleeps out
+    the rest of the period.
+*/
+static void *maint_main(void *arg) {
+    struct timespec start, now;
+    long used;
+    int done;
+
+    while(maint_on) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            mm_lock(&heap_lock);
+            done = drain_deferred(&default_heap, MAINT_BATCH) < MAINT_BATCH;
+            if(done) {
+                trim_heap(&default_heap, MAX(CHUNKSIZE, reserve_pad));
+                if(decay_us) {
+                    decay_tick(&default_heap);
+                }
+            }
+            mm_unlock(&heap_lock);
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            used = (now.tv_sec - start.tv_sec) * 1000000000L +
+                   (now.tv_nsec - start.tv_nsec);
+        } while(!done && used < maint_budget && maint_on);
+
+        if(used < maint_period) {
+            now.tv_sec = 0;
+            now.tv_nsec = maint_period - used;
+            while(now.tv_nsec >= 1000000000L) {
+                now.tv_sec++;
+                now.tv_nsec -= 1000000000L;
+            }
+            nanosleep(&now, NULL);
         }
-        bp = NEXT_BLKP(bp);
     }
-
-    return NULL;
+    return arg;
 }
 
-//uses the boundary tag coalescing technique
-//uses the four cases from the textbook and is implemented below
-static void *coalesce(void *bp) {
-    //code is based off of Computer Systems Textbook, Section 9.9
-    //Dynamic Memory Allocation page 896, figure 9.46
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+/*
+    The drain_deferred function frees up to max (all if negative) of the
+    blocks queued by mm_free, oldest first, and puts the rest back.
+    Returns the number freed. Called with the heap lock held.
+*/
+static int drain_deferred(mm_heap_t *h, int max) {
+    void *list, *bp, *prev = NULL, *rest;
+    int n = 0;
 
-    //case 1, next and prev both allocated
-    if(prev_alloc && next_alloc) {
-        return bp;
+    if((list = __atomic_exchange_n(&deferred, NULL, __ATOMIC_ACQUIRE)) == NULL) {
+        return 0;
     }
-    //case 2, prev is allocated, and next is free
-    else if(prev_alloc && !next_alloc) {
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+    //the queue is a stack; reverse it so frees happen in mm_free order
+    while(list != NULL) {
+        bp = list;
+        list = *(void **)bp;
+        *(void **)bp = prev;
+        prev = bp;
     }
-    //case 3, prev is free and next is allocated
-    else if(!prev_alloc && next_alloc) {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+    for(list = prev; list != NULL && n != max; n++) {
+        bp = list;
+        list = *(void **)bp;
+        mm_heap_free(h, bp);
     }
-    //case 4, previous and next are free
-    else {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+
+    //requeue what is left behind anything pushed in the meantime
+    while(list != NULL) {
+        bp = list;
+        list = *(void **)bp;
+        rest = __atomic_load_n(&deferred, __ATOMIC_RELAXED);
+        do {
+            *(void **)bp = rest;
+        } while(!__atomic_compare_exchange_n(&deferred, &rest, bp, 1,
+                                             __ATOMIC_RELEASE,
+                                             __ATOMIC_RELAXED));
     }
+    return n;
+}
 
-    //makes sure that rover is not pointing to a block that has been recently freed
-    if((rover < NEXT_BLKP(bp)) && (rover > (char *)bp)) {
-        rover = bp;
+/*
+ * mm_epoch_enter - starts a critical section of the calling thread. No
+ * block passed to mm_free_deferred, by any thread, is freed while a
+ * section that was already running when it was passed is still open.
+ * Sections nest.
+ */
+void mm_epoch_enter(void) {
+    epoch_rec_t *r = my_epoch();
+    unsigned long e;
+
+    if(r->depth++ == 0) {
+        e = __atomic_load_n(&epoch_global, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->state, e << 1 | 1, __ATOMIC_RELAXED);
+        //publish the epoch before reading anything it protects
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
     }
-    return bp;
 }
+
+/*
+ * mm_epoch_exit - ends the critical section begun by the matching
+ * mm_epoch_enter
+ */
+void mm_epoch_exit(void) {
+    epoch_rec_t *r = my_epoch_rec;
+
+    if(--r->depth == 0) {
+        __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+        if(r->retired >= EPOCH_BATCH) {
+            epoch_reclaim(r);
+        }
+    }
+}
+
+/*
+ * mm_free_deferred - frees a block of the default heap once every
+ * critical section that might still be reading it has ended. The caller
+ * must already have made bp unreachable for sections that start later.
+ */
+void mm_free_deferred(void *bp) {
+    epoch_rec_t *r;
+    unsigned long e;
+    int i;
+
+    if(bp == NULL) {
+        return;
+    }
+    r = my_epoch();
+    //order the caller's unlinking of bp before reading the epoch
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    e = __atomic_load_n(&epoch_global, __ATOMIC_RELAXED);
+    i = e % 3;
+    if(r->limbo_epoch[i] != e) {
+        //the list still holds epoch e - 3 or older, which is safe
+        epoch_ready(r, i);
+        r->limbo_epoch[i] = e;
+    }
+    retired_add(&r->limbo[i], bp);
+    //a thread that reclaims inside its critical section holds the epoch
+    //back while it does, so leave that to mm_epoch_exit
+    if(++r->retired >= EPOCH_BATCH && r->depth == 0) {
+        epoch_reclaim(r);
+    }
+}
+
+/*
+ * mm_epoch_flush - advances the epoch as far as the open critical
+ * sections allow and frees every deferred block that is then safe,
+ * including those of threads that have exited. Returns the number of
+ * blocks freed.
+ */
+size_t mm_epoch_flush(void) {
+    epoch_rec_t *r;
+    size_t n = 0;
+    int unowned;
+
+    //blocks retired in epoch e are safe from epoch e + 2 on
+    epoch_advance();
+    epoch_advance();
+    for(r = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); r != NULL;
+        r = r->next) {
+        unowned = 0;
+        if(r == my_epoch_rec) {
+            n += epoch_collect(r);
+        } else if(__atomic_compare_exchange_n(&r->owned, &unowned, 1, 0,
+                                              __ATOMIC_ACQUIRE,
+                                              __ATOMIC_RELAXED)) {
+            n += epoch_collect(r);
+            __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+        }
+    }
+    return n;
+}
+
+//returns the calling thread's record, adopting an unowned one or making
+//a new one on its first call
+static epoch_rec_t *my_epoch(void) {
+    epoch_rec_t *r;
+    int unowned;
+
+    if(my_epoch_rec != NULL) {
+        return my_epoch_rec;
+    }
+    pthread_once(&epoch_once, epoch_key_init);
+    for(r = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); r != NULL;
+        r = r->next) {
+        unowned = 0;
+        if(__atomic_compare_exchange_n(&r->owned, &unowned, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if(r == NULL) {
+        if((r = aligned_alloc(64, sizeof(epoch_rec_t))) == NULL) {
+            fprintf(stderr, "mm_epoch: out of memory\n");
+            abort();
+        }
+        memset(r, 0, sizeof(epoch_rec_t));
+        r->owned = 1;
+        r->next = __atomic_load_n(&epoch_recs, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&epoch_recs, &r->next, r, 1,
+                                           __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(epoch_key, r);
+    return my_epoch_rec = r;
+}
+
+/*
+    The epoch_advance function moves the global epoch on by one if every
+    thread in a critical section has entered it in the current epoch.
+    Returns 0 if one of them holds it back.
+*/
+static int epoch_advance(void) {
+    unsigned long e = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+    unsigned long state;
+    epoch_rec_t *r;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for(r = __atomic_load_n(&epoch_recs, __ATOMIC_ACQUIRE); r != NULL;
+        r = r->next) {
+        state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+        if((state & 1) && state >> 1 != e) {
+            return 0;
+        }
+    }
+    __atomic_compare_exchange_n(&epoch_global, &e, e + 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    return 1;
+}
+
+//advances the epoch if it can and frees the safe blocks of r, which the
+//caller owns. A thread preempted in its critical section holds the epoch
+//back until it runs again, and meanwhile every other thread's frees pile
+//up, so give it the CPU once before settling for no progress.
+static void epoch_reclaim(epoch_rec_t *r) {
+    r->retired = 0;
+    if(!epoch_advance()) {
+        sched_yield();
+        epoch_advance();
+    }
+    epoch_collect(r);
+}
+
+//moves limbo list i of r, whose blocks are safe to free, to r->ready
+static void epoch_ready(epoch_rec_t *r, int i) {
+    retired_t *l = &r->limbo[i], t;
+    unsigned int j;
+
+    if(r->ready.n == 0) {
+        //the usual case: swap the arrays rather than copy them
+        t = r->ready;
+        r->ready = *l;
+        *l = t;
+        return;
+    }
+    for(j = 0; j < l->n; j++) {
+        retired_add(&r->ready, l->bps[j]);
+    }
+    l->n = 0;
+}
+
+//appends bp to l, doubling its array when full
+static void retired_add(retired_t *l, void *bp) {
+    unsigned int max;
+    void **bps;
+
+    if(l->n == l->max) {
+        max = l->max ? 2 * l->max : EPOCH_BATCH;
+        if((bps = realloc(l->bps, max * sizeof(void *))) == NULL) {
+            fprintf(stderr, "mm_epoch: out of memory\n");
+            abort();
+        }
+        l->bps = bps;
+        l->max = max;
+    }
+    l->bps[l->n++] = bp;
+}
+
+/*
+    The epoch_collect function frees the blocks of record r that were
+    retired two or more epochs ago and returns how many it freed. Blocks
+    the caches take go there; the rest are freed under one hold of
+    heap_lock. The caller must own r.
+*/
+static size_t epoch_collect(epoch_rec_t *r) {
+    unsigned long e = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+    size_t n;
+    unsigned int i, rest = 0;
+    void *bp;
+
+    for(i = 0; i < 3; i++) {
+        if(r->limbo_epoch[i] + 2 <= e) {
+            epoch_ready(r, i);
+        }
+    }
+    //keep the blocks the caches do not take at the front of the array
+    n = r->ready.n;
+    for(i = 0; i < r->ready.n; i++) {
+        bp = r->ready.bps[i];
+        if(MM_GUARD_OWNS(bp) || MM_SLAB_OWNS(bp) || MM_GRAN_OWNS(bp) ||
+           !cache_mode || !cache_push(bp)) {
+            r->ready.bps[rest++] = bp;
+        }
+    }
+    r->ready.n = 0;
+    if(rest == 0) {
+        return n;
+    }
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
+    }
+    for(i = 0; i < rest; i++) {
+        bp = r->ready.bps[i];
+        if(MM_GUARD_OWNS(bp)) {
+            mm_guard_free(bp);
+        } else if(MM_SLAB_OWNS(bp)) {
+            mm_slab_free(bp);
+        } else if(MM_GRAN_OWNS(bp)) {
+            mm_gran_free(bp);
+        } else {
+            mm_heap_free(&default_heap, bp);
+        }
+    }
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
+    }
+    return n;
+}
+
+//pthread key destructor: frees what it can and leaves the rest of a
+//finished thread's blocks in its record for the next owner
+static void epoch_exit(void *arg) {
+    epoch_rec_t *r = arg;
+
+    r->depth = 0;
+    r->retired = 0;
+    __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+    epoch_collect(r);
+    my_epoch_rec = NULL;
+    __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_key_init(void) {
+    pthread_key_create(&epoch_key, epoch_exit);
+}
+
+/*
+ * mm_release_threshold - makes mm_free give back the pages of every free
+ * block of at least bytes bytes it produces below the top of the heap.
+ * 0, the default, turns this off, since pages released this way fault
+ * back in when the block is reused.
+ */
+void mm_release_threshold(size_t bytes) {
+    release_min = bytes;
+}
+
+/*
+ * mm_release - gives the pages inside every free block of the default heap
+ * back to the system, whatever the block's size. Returns the number of
+ * bytes released.
+ */
+size_t mm_release(void) {
+    mm_heap_t *h = &default_heap;
+    size_t released = 0;
+    char *bp;
+
+    if(maint_on || cache_mode) {
+        mm_lock(&heap_lock);
+    }
+    for(bp = NEXT_BLKP(h->heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        if(!GET_ALLOC(HDRP(bp))) {
+            released += release_block(h, bp);
+        }
+    }
+    if(maint_on || cache_mode) {
+        mm_unlock(&heap_lock);
+    }
+    return released;
+}
+
+/*
+ * mm_decay - releases the dirty pages of free blocks in the default heap
+ * gradually, over decay_ms milliseconds after they were freed, instead of
+ * all at once or never. The bytes freed in each of DECAY_EPOCHS epochs
+ * are allowed to stay dirty in proportion to 1 - smoothstep(age /
+ * decay_ms), and whenever an epoch ends, free blocks are released until
+ * the heap is back under that limit. Epochs end on the mm_malloc and
+ * mm_free paths, or on the maintenance thread if it runs. 0 turns decay
+ * off, the default.
+ */
+void mm_decay(unsigned long decay_ms) {
+    decay_us = decay_ms * 1000;
+    decay_epoch = decay_clock();
+}
+
+/*
+ * mm_decay_clock - sets the microsecond clock that decay runs on, which
+ * need not be real time; NULL restores the monotonic clock
+ */
+void mm_decay_clock(unsigned long (*now_us)(void)) {
+    decay_clock = now_us ? now_us : decay_clock_mono;
+    decay_epoch = decay_clock();
+}
+
+/*
+    The decay_tick function ends the epochs that have run out, aging what
+    was freed in them, and purges the heap down to the new limit.
+*/
+static void decay_tick(mm_heap_t *h) {
+    unsigned long len = decay_us / DECAY_EPOCHS;
+    unsigned long n, now = decay_clock();
+    double x, limit = 0;
+    int i;
+
+    if(len == 0 || now - decay_epoch < len) {
+        return;
+    }
+    n = (now - decay_epoch) / len;
+    decay_epoch += n * len;
+    if(n >= DECAY_EPOCHS) {
+        memset(decay_freed, 0, sizeof(decay_freed));
+    } else {
+        memmove(decay_freed + n, decay_freed,
+                (DECAY_EPOCHS - n) * sizeof(size_t));
+        memset(decay_freed, 0, n * sizeof(size_t));
+    }
+
+    //what was freed i epochs ago may still be dirty in this proportion
+    for(i = 1; i < DECAY_EPOCHS; i++) {
+        x = (double)i / DECAY_EPOCHS;
+        limit += decay_freed[i] * (1.0 - x * x * (3.0 - 2.0 * x));
+    }
+    if(decay_dirty > limit) {
+        decay_purge(h, (size_t)limit);
+    }
+}
+
+/*
+    The decay_purge function measures the dirty free bytes of the heap,
+    then releases free blocks, lowest first, until no more than limit
+    remain.
+*/
+static void decay_purge(mm_heap_t *h, size_t limit) {
+    size_t dirty = 0;
+    char *bp;
+
+    for(bp = NEXT_BLKP(h->heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        if(!(GET(HDRP(bp)) & (DECOMMITTED | 0x1))) {
+            dirty += GET_SIZE(HDRP(bp));
+        }
+    }
+    for(bp = NEXT_BLKP(h->heap_listp); dirty > limit && GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        if(!(GET(HDRP(bp)) & (DECOMMITTED | 0x1))) {
+            dirty -= GET_SIZE(HDRP(bp));
+            release_block(h, bp);
+        }
+    }
+    decay_dirty = dirty;
+}
+
+//the default decay clock, in microseconds
+static unsigned long decay_clock_mono(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * mm_caches - puts caches of small free blocks in front of the default
+ * heap and makes mm_malloc, mm_free and mm_realloc thread safe: requests
+ * the caches cannot serve take heap_lock. MM_CACHES_CPU keeps one cache
+ * per CPU, whose stacks are pushed and popped in Linux restartable
+ * sequences, so a thread that is preempted or migrated in the middle
+ * simply retries and no locked instruction is needed. Without rseq it
+ * falls back to MM_CACHES_THREAD, one cache per thread, which costs a
+ * cache's worth of blocks for every thread instead of every CPU.
+ * Returns the mode in effect. Must not be called while other threads
+ * use the heap; blocks cached by other threads stay in their caches.
+ */
+int mm_caches(int mode) {
+    if(mode == MM_CACHES_CPU && !cpu_caches_init()) {
+        mode = MM_CACHES_THREAD;
+    }
+    if(cache_mode == MM_CACHES_CPU && mode != MM_CACHES_CPU) {
+        int cpu;
+
+        for(cpu = 0; cpu < ncpus; cpu++) {
+            cache_flush(&cpu_caches[cpu]);
+        }
+    }
+    if(cache_mode == MM_CACHES_THREAD && mode != MM_CACHES_THREAD &&
+       thread_cache.gen == cache_gen) {
+        thread_cache_flush(&thread_cache);
+    }
+    cache_mode = mode;
+    return mode;
+}
+
+/*
+ * mm_caches_limit - caps the bytes that all per-thread caches together
+ * may hold, CACHE_LIMIT by default. Each thread charges the cap a lease
+ * of CACHE_LEASE bytes at a time, so this is only one atomic add per
+ * lease; frees that would go over it go to the heap instead.
+ */
+void mm_caches_limit(size_t bytes) {
+    cache_limit = bytes;
+}
+
+#if HAVE_RSEQ
+//this thread's rseq area, registered by glibc
+#define RSEQ_AREA() \
+    ((struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset))
+#define RSEQ_STR(x) RSEQ_STR2(x)
+#define RSEQ_STR2(x) #x
+
+//opens a restartable sequence that runs from 1: to its commit at 2:
+//and restarts at 4:, after storing its descriptor in rseq_cs
+#define RSEQ_BEGIN \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3: .long 0, 0\n\t" \
+    ".quad 1f, 2f - 1f, 4f\n\t" \
+    ".popsection\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t" \
+    "1:\n\t" \
+    "cmpl %[cpu], %[cpu_id]\n\t" \
+    "jnz 4f\n\t"
+
+//the kernel only jumps to an abort handler preceded by the signature
+//the rseq area was registered with
+#define RSEQ_END \
+    "2:\n\t" \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long " RSEQ_STR(RSEQ_SIG) "\n\t" \
+    "4: jmp %l[restart]\n\t" \
+    ".popsection\n\t"
+
+/*
+    The cpu_pop function pops a block from stack cls of the current CPU's
+    cache, or returns NULL if the stack is empty. The load of the top
+    block and the store of the new count happen in one restartable
+    sequence, so no other thread on this CPU can get in between.
+*/
+static void *cpu_pop(int cls) {
+    struct rseq *rs = RSEQ_AREA();
+    unsigned int cpu;
+    cache_t *c;
+    void *bp;
+
+restart:
+    cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+    c = &cpu_caches[cpu];
+    __asm__ goto(RSEQ_BEGIN
+                 "movq (%[count]), %%rax\n\t"
+                 "testq %%rax, %%rax\n\t"
+                 "jz %l[empty]\n\t"
+                 "movq -8(%[slot], %%rax, 8), %%rcx\n\t"
+                 "movq %%rcx, (%[bp])\n\t"
+                 "decq %%rax\n\t"
+                 "movq %%rax, (%[count])\n\t"
+                 RSEQ_END
+                 : : [rseq_cs] "m" (rs->rseq_cs), [cpu_id] "m" (rs->cpu_id),
+                   [cpu] "r" (cpu), [count] "r" (&c->count[cls]),
+                   [slot] "r" (c->slot[cls]), [bp] "r" (&bp)
+                 : "rax", "rcx", "memory", "cc"
+                 : empty, restart);
+    return bp;
+empty:
+    return NULL;
+}
+
+/*
+    The cpu_push function pushes bp onto stack cls of the current CPU's
+    cache; it returns 0 if the stack is full.
+*/
+static int cpu_push(int cls, void *bp) {
+    struct rseq *rs = RSEQ_AREA();
+    unsigned int cpu;
+    cache_t *c;
+
+restart:
+    cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+    c = &cpu_caches[cpu];
+    __asm__ goto(RSEQ_BEGIN
+                 "movq (%[count]), %%rax\n\t"
+                 "cmpq %[depth], %%rax\n\t"
+                 "jae %l[full]\n\t"
+                 "movq %[bp], (%[slot], %%rax, 8)\n\t"
+                 "incq %%rax\n\t"
+                 "movq %%rax, (%[count])\n\t"
+                 RSEQ_END
+                 : : [rseq_cs] "m" (rs->rseq_cs), [cpu_id] "m" (rs->cpu_id),
+                   [cpu] "r" (cpu), [count] "r" (&c->count[cls]),
+                   [slot] "r" (c->slot[cls]), [depth] "i" (CACHE_DEPTH),
+                   [bp] "r" (bp)
+                 : "rax", "memory", "cc"
+                 : full, restart);
+    return 1;
+full:
+    return 0;
+}
+
+//makes the per-CPU caches; fails if glibc has not registered rseq
+static int cpu_caches_init(void) {
+    if(cpu_caches == NULL && __rseq_size > 0) {
+        ncpus = sysconf(_SC_NPROCESSORS_CONF);
+        if((cpu_caches = aligned_alloc(64, ncpus * sizeof(cache_t))) != NULL) {
+            memset(cpu_caches, 0, ncpus * sizeof(cache_t));
+        }
+    }
+    return cpu_caches != NULL;
+}
+#else
+static void *cpu_pop(int cls) {
+    return NULL;
+}
+
+static int cpu_push(int cls, void *bp) {
+    return 0;
+}
+
+static int cpu_caches_init(void) {
+    return 0;
+}
+#endif
+
+/*
+    The cache_malloc function serves a request of size bytes from the
+    caches, refilling them if they have no block of its adjusted size.
+    Returns NULL if the request is too big for the caches.
+*/
+static void *cache_malloc(size_t size) {
+    size_t asize;
+    tcache_t *t;
+    void *bp;
+    int cls;
+
+    if(size == 0 || size > CACHE_MAX - DSIZE) {
+        return NULL;
+    }
+    //same adjustment as mm_heap_malloc
+    asize = size <= DSIZE ? 2 * DSIZE :
+        DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+    cls = asize / DSIZE - 2;
+    if(cache_mode == MM_CACHES_CPU) {
+        bp = cpu_pop(cls);
+        return bp ? bp : cache_refill(asize, CACHE_BATCH);
+    }
+
+    if((t = my_thread_cache()) == NULL) {
+        return NULL;
+    }
+    if(t->c.count[cls] == 0) {
+        //let the stack hold more, and refill it up to half of that
+        t->misses[cls]++;
+        t->max[cls] = MIN(t->max[cls] * 2, CACHE_DEPTH);
+        return cache_refill(asize, t->max[cls] / 2 + 1);
+    }
+    bp = t->c.slot[cls][--t->c.count[cls]];
+    t->bytes -= asize;
+    if(t->c.count[cls] < t->low[cls]) {
+        t->low[cls] = t->c.count[cls];
+    }
+    if(++t->ops % CACHE_GC_OPS == 0) {
+        thread_cache_gc(t);
+    }
+    return bp;
+}
+
+/*
+    The cache_refill function takes one chunk of n blocks of asize bytes
+    from the default heap, so that only one in several misses takes
+    heap_lock. The chunk is carved up before the lock is dropped, since
+    whatever walks the heap under the lock steps through the tags inside
+    it; the tags at its ends stay allocated. The last block, which also
+    gets any slack, is returned and the others go into the caches.
+*/
+static void *cache_refill(size_t asize, int n) {
+    char *chunk, *end, *last, *bp;
+
+    mm_lock(&heap_lock);
+    if((chunk = mm_heap_malloc(&default_heap, n * asize - DSIZE)) != NULL) {
+        if(GET(HDRP(chunk)) & SAMPLED) {
+            mm_prof_free(chunk);
+        }
+        end = chunk + GET_SIZE(HDRP(chunk));
+        last = chunk + (n - 1) * asize;
+        for(bp = chunk; bp < last; bp += asize) {
+            PUT(HDRP(bp), PACK(asize, 1));
+            PUT(FTRP(bp), PACK(asize, 1));
+        }
+        PUT(HDRP(last), PACK(end - last, 1));
+        PUT(FTRP(last), PACK(end - last, 1));
+    }
+    mm_unlock(&heap_lock);
+    if(chunk == NULL) {
+        return NULL;
+    }
+
+    //push from the top down, so the blocks are handed out in address order
+    for(bp = last - asize; bp >= chunk; bp -= asize) {
+        if(!cache_push(bp)) {
+            mm_lock(&heap_lock);
+            mm_heap_free(&default_heap, bp);
+            mm_unlock(&heap_lock);
+        }
+    }
+    return last;
+}
+
+/*
+    The cache_push function keeps the allocated block bp in the caches
+    instead of freeing it. Returns 0 if it is too big, sampled by the
+    profiler, its stack is full, or the thread caches are at their cap.
+*/
+static int cache_push(void *bp) {
+    unsigned int hdr = GET(HDRP(bp));
+    size_t size = hdr & ~0x7;
+    tcache_t *t;
+    int cls;
+
+    if((hdr & (SAMPLED | MOVABLE)) || size > CACHE_MAX) {
+        return 0;
+    }
+    cls = size / DSIZE - 2;
+    if(cache_mode == MM_CACHES_CPU) {
+        return cpu_push(cls, bp);
+    }
+    if((t = my_thread_cache()) == NULL) {
+        return 0;
+    }
+    if(t->bytes + size > t->charged && !cache_charge(t, size)) {
+        return 0;
+    }
+    if(t->c.count[cls] >= t->max[cls]) {
+        //let the stack hold more, or once it cannot, empty half of it
+        t->misses[cls]++;
+        if(t->max[cls] < CACHE_DEPTH) {
+            t->max[cls] = MIN(t->max[cls] * 2, CACHE_DEPTH);
+        } else {
+            mm_lock(&heap_lock);
+            while(t->c.count[cls] > CACHE_DEPTH / 2) {
+                mm_heap_free(&default_heap, t->c.slot[cls][--t->c.count[cls]]);
+                t->bytes -= size;
+            }
+            mm_unlock(&heap_lock);
+        }
+    }
+    t->c.slot[cls][t->c.count[cls]++] = bp;
+    t->bytes += size;
+    if(++t->ops % CACHE_GC_OPS == 0) {
+        thread_cache_gc(t);
+    }
+    return 1;
+}
+
+/*
+    The my_thread_cache function returns this thread's cache, setting it
+    up on first use, and again if mm_init ran since, which drops whatever
+    it held. The first use also arranges for the cache to be flushed
+    when the thread exits, so its blocks are not stranded. Returns NULL
+    once that flush has run: other key destructors, such as the one that
+    frees the thread's deferred blocks, may still free and allocate, and
+    their blocks must go to the heap.
+*/
+static tcache_t *my_thread_cache(void) {
+    tcache_t *t = &thread_cache;
+    int cls;
+
+    if(t->exited) {
+        return NULL;
+    }
+    if(t->gen != cache_gen) {
+        if(t->gen == 0) {
+            pthread_once(&thread_cache_once, thread_cache_key_init);
+            pthread_setspecific(thread_cache_key, t);
+        }
+        memset(t, 0, sizeof(*t));
+        for(cls = 0; cls < CACHE_CLASSES; cls++) {
+            t->max[cls] = CACHE_MIN;
+        }
+        t->gen = cache_gen;
+    }
+    return t;
+}
+
+/*
+    The thread_cache_gc function runs every CACHE_GC_OPS operations on a
+    thread's cache. A stack that never ran empty or full but never ran
+    below low blocks either did not need those blocks or was not used at
+    all, so half of them go back to the heap and its capacity is halved.
+*/
+static void thread_cache_gc(tcache_t *t) {
+    size_t size;
+    int cls, n, locked = 0;
+
+    for(cls = 0; cls < CACHE_CLASSES; cls++) {
+        if(t->misses[cls] == 0 && t->low[cls] > 0) {
+            if(!locked) {
+                mm_lock(&heap_lock);
+                locked = 1;
+            }
+            size = (cls + 2) * DSIZE;
+            for(n = (t->low[cls] + 1) / 2; n > 0; n--) {
+                mm_heap_free(&default_heap, t->c.slot[cls][--t->c.count[cls]]);
+                t->bytes -= size;
+            }
+            t->max[cls] = MAX(t->max[cls] / 2, CACHE_MIN);
+        }
+        t->misses[cls] = 0;
+        t->low[cls] = t->c.count[cls];
+    }
+    if(locked) {
+        mm_unlock(&heap_lock);
+    }
+    cache_uncharge(t);
+}
+
+//empties a thread's cache into the heap and hands back its charge
+static void thread_cache_flush(tcache_t *t) {
+    cache_flush(&t->c);
+    t->bytes = 0;
+    cache_uncharge(t);
+}
+
+//pthread key destructor: flushes the cache of an exiting thread
+static void thread_cache_exit(void *arg) {
+    tcache_t *t = arg;
+
+    if(t->gen == cache_gen) {
+        thread_cache_flush(t);
+    }
+    t->exited = 1;
+}
+
+static void thread_cache_key_init(void) {
+    pthread_key_create(&thread_cache_key, thread_cache_exit);
+}
+
+//charges another lease to cache_limit; returns 0 if that would exceed it
+static int cache_charge(tcache_t *t, size_t size) {
+    size_t lease = MAX(CACHE_LEASE, size);
+
+    if(__atomic_add_fetch(&cache_charged, lease, __ATOMIC_RELAXED) >
+       cache_limit) {
+        __atomic_sub_fetch(&cache_charged, lease, __ATOMIC_RELAXED);
+        return 0;
+    }
+    t->charged += lease;
+    return 1;
+}
+
+//hands back the leases a thread's cache no longer needs
+static void cache_uncharge(tcache_t *t) {
+    size_t keep = (t->bytes + CACHE_LEASE - 1) / CACHE_LEASE * CACHE_LEASE;
+
+    if(t->charged > keep) {
+        __atomic_sub_fetch(&cache_charged, t->charged - keep,
+                           __ATOMIC_RELAXED);
+        t->charged = keep;
+    }
+}
+
+//frees every block in a cache back to the default heap
+static void cache_flush(cache_t *c) {
+    int cls;
+
+    mm_lock(&heap_lock);
+    for(cls = 0; cls < CACHE_CLASSES; cls++) {
+        while(c->count[cls] > 0) {
+            mm_heap_free(&default_heap, c->slot[cls][--c->count[cls]]);
+        }
+    }
+    mm_unlock(&heap_lock);
+}
+
+/*
+    The release_block function decommits the whole pages between the
+    free list links and the footer of the free block bp and marks it
+    DECOMMITTED, so
+    that it is not released twice. The mark is lost when the block is
+    coalesced or allocated, and kept by the free remainder of a split,
+    whose pages were not touched. Returns the number of bytes released.
+*/
+static size_t release_block(mm_heap_t *h, char *bp) {
+    size_t n;
+
+    if(GET(HDRP(bp)) & DECOMMITTED) {
+        return 0;
+    }
+    if((n = mem_region_decommit(h->mem, bp + sizeof(freeblock_t),
+                                FTRP(bp))) > 0) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | DECOMMITTED);
+        PUT(FTRP(bp), GET(FTRP(bp)) | DECOMMITTED);
+        STAT_INC(decommits);
+        STAT_ADD(decommit_bytes, n);
+    }
+    return n;
+}
+
+/*
+    The trim_heap function gives all but pad bytes of the free block at
+    the top of the heap back to memlib (all of it if pad is 0). Returns
+    the number of bytes released.
+*/
+static size_t trim_heap(mm_heap_t *h, size_t pad) {
+    char *last = PREV_BLKP((char *)mem_region_hi(h->mem) + 1);
+    size_t size = GET_SIZE(HDRP(last));
+
+    if(last == h->heap_listp || GET_ALLOC(HDRP(last)) || size <= pad) {
+        return 0;
+    }
+    if(pad == 0) {
+        //the free block becomes the new epilogue
+        list_remove(h, last);
+        if(h->last_bp == last) {
+            h->last_bp = NULL;
+        }
+        PUT(HDRP(last), PACK(0, 1));
+    } else {
+        PUT(HDRP(last), PACK(pad, 0));
+        PUT(FTRP(last), PACK(pad, 0));
+        PUT(HDRP(NEXT_BLKP(last)), PACK(0, 1));
+    }
+    mem_region_trim(h->mem, size - pad);
+    return size - pad;
+}
+
+/*
+ * mm_check - Scans the whole heap for inconsistencies: the prologue and
+ * epilogue, every block's boundary tags, alignment and bounds, that no
+ * two free blocks are adjacent, and that the free list holds exactly the
+ * free blocks, last remainder included, none of them but the wilderness
+ * bigger than the fit bound. Prints the first problem found to stderr and
+ * returns 0, or returns 1 if the heap is consistent. O(heap).
+ */
+int mm_check(void) {
+    mm_heap_t *h = &default_heap;
+    char *heap_listp = h->heap_listp;
+    char *bp;
+    char *lo = mem_region_lo(h->mem);
+    char *hi = mem_region_hi(h->mem);
+    unsigned long nfree = 0, listed = 0;
+    unsigned int off, prev = 0;
+    int found_rem = 0;
+
+    //prologue is an allocated DSIZE block right after the padding word
+    CHECK(heap_listp == lo + DSIZE, heap_listp, "prologue is misplaced");
+    CHECK(GET(HDRP(heap_listp)) == PACK(DSIZE, 1), heap_listp,
+          "bad prologue header");
+    CHECK(GET(FTRP(heap_listp)) == PACK(DSIZE, 1), heap_listp,
+          "bad prologue footer");
+
+    //block level invariants
+    for(bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        if(!check_block(h, bp)) {
+            return 0;
+        }
+        if(!GET_ALLOC(HDRP(bp))) {
+            nfree++;
+        }
+    }
+
+    //epilogue header must be the last word of the heap
+    CHECK(GET(HDRP(bp)) == PACK(0, 1), bp, "bad epilogue header");
+    CHECK(HDRP(bp) == (char *)mem_region_hi(h->mem) - (WSIZE - 1), bp,
+          "epilogue is not at the end of the heap");
+
+    //the free list is doubly linked through free blocks only, and no
+    //longer than the number of free blocks, so it cannot loop
+    for(off = h->free_list; off != 0; off = FREEBLK(bp)->next) {
+        bp = FREE_BLKP(h, off);
+        CHECK(bp > heap_listp && bp < hi && (size_t)bp % ALIGNMENT == 0, bp,
+              "free list points outside the heap");
+        CHECK(!GET_ALLOC(HDRP(bp)), bp, "allocated block on the free list");
+        CHECK(FREEBLK(bp)->prev == prev, bp, "free list links disagree");
+        CHECK(GET_SIZE(HDRP(bp)) <= h->fit_bound || off == WILDERNESS(h), bp,
+              "free block bigger than the fit bound");
+        CHECK(++listed <= nfree, bp, "free list is longer than the heap's");
+        if(off == h->last_rem) {
+            found_rem = 1;
+        }
+        prev = off;
+    }
+    CHECK(listed == nfree, heap_listp, "free block missing from the free list");
+    CHECK(h->last_rem == 0 || found_rem, FREE_BLKP(h, h->last_rem),
+          "last remainder is not on the free list");
+    return 1;
+}
+
+/*
+ * mm_check_last - Checks only the block touched by the most recent
+ * mm_malloc/mm_free/mm_realloc and its two neighbours. O(1), so it is
+ * cheap enough to run after every request. Returns 0 on an inconsistency.
+ */
+int mm_check_last(void) {
+    mm_heap_t *h = &default_heap;
+    char *bp = h->last_bp;
+
+    if(bp == NULL) {
+        return 1;
+    }
+    if(!check_block(h, bp)) {
+        return 0;
+    }
+    if(PREV_BLKP(bp) != h->heap_listp && !check_block(h, PREV_BLKP(bp))) {
+        return 0;
+    }
+    if(GET_SIZE(HDRP(NEXT_BLKP(bp))) > 0 && !check_block(h, NEXT_BLKP(bp))) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * mm_heapmap - Writes the page occupancy of the heap to fp as a binary
+ * PPM image with HEAPMAP_WIDTH pages per row. Each block contributes its
+ * header and footer as metadata (red) and its payload as allocated
+ * (green) or free (blue) bytes to the pages it spans. Returns 0, or -1
+ * if the map could not be built.
+ */
+int mm_heapmap(FILE *fp) {
+    char *heap_listp = default_heap.heap_listp;
+    char *lo = mem_heap_lo();
+    size_t pagesize = mem_pagesize();
+    size_t npages = (mem_heapsize() + pagesize - 1) / pagesize;
+    size_t rows = (npages + HEAPMAP_WIDTH - 1) / HEAPMAP_WIDTH;
+    size_t (*bytes)[3];
+    size_t i;
+    int c;
+    char *bp;
+
+    if((bytes = calloc(rows * HEAPMAP_WIDTH, sizeof(*bytes))) == NULL) {
+        return -1;
+    }
+
+    //padding word, prologue and epilogue are all metadata
+    heapmap_add(bytes, lo, heap_listp + DSIZE, 0);
+    for(bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
+        heapmap_add(bytes, HDRP(bp), bp, 0);
+        heapmap_add(bytes, bp, FTRP(bp), GET_ALLOC(HDRP(bp)) ? 1 : 2);
+        heapmap_add(bytes, FTRP(bp), FTRP(bp) + WSIZE, 0);
+    }
+    heapmap_add(bytes, HDRP(bp), bp, 0);
+
+    fprintf(fp, "P6\n%d %lu\n255\n", HEAPMAP_WIDTH, (unsigned long)rows);
+    for(i = 0; i < rows * HEAPMAP_WIDTH; i++) {
+        for(c = 0; c < 3; c++) {
+            fputc((int)(bytes[i][c] * 255 / pagesize), fp);
+        }
+    }
+    free(bytes);
+    return ferror(fp) ? -1 : 0;
+}
+
+/*
+    The heapmap_add function credits the bytes in [start, end) to the
+    given class (0 metadata, 1 allocated, 2 free) of every page they
+    touch.
+*/
+static void heapmap_add(size_t (*bytes)[3], char *start, char *end, int c) {
+    char *lo = mem_heap_lo();
+    size_t pagesize = mem_pagesize();
+
+    while(start < end) {
+        size_t page = (start - lo) / pagesize;
+        char *page_end = lo + (page + 1) * pagesize;
+        char *stop = end < page_end ? end : page_end;
+
+        bytes[page][c] += stop - start;
+        start = stop;
+    }
+}
+
+/*
+    The check_block function verifies the invariants of a single regular
+    block: it lies inside the heap, is aligned, its header matches its
+    footer, and a free block has no free neighbours.
+*/
+static int check_block(mm_heap_t *h, void *bp) {
+    char *heap_listp = h->heap_listp;
+    char *hi = mem_region_hi(h->mem);
+    size_t size;
+
+    CHECK((char *)bp > heap_listp && (char *)bp < hi, bp,
+          "block lies outside the heap");
+    CHECK((size_t)bp % ALIGNMENT == 0, bp, "payload is not aligned");
+
+    size = GET_SIZE(HDRP(bp));
+    CHECK(size >= 2 * DSIZE, bp, "block is smaller than the minimum size");
+    CHECK(FTRP(bp) + WSIZE <= hi - (WSIZE - 1), bp,
+          "block runs past the end of the heap");
+    CHECK(GET(HDRP(bp)) == GET(FTRP(bp)), bp, "header and footer differ");
+    CHECK(PREV_BLKP(bp) >= heap_listp, bp,
+          "previous block's footer points outside the heap");
+
+    if(!GET_ALLOC(HDRP(bp))) {
+        CHECK(GET_ALLOC(HDRP(PREV_BLKP(bp))), bp,
+              "free block follows a free block");
+        CHECK(GET_ALLOC(HDRP(NEXT_BLKP(bp))), bp,
+              "free block precedes a free block");
+    }
+    return 1;
+}
+
+/*
+    The heap_init function lays down the padding word, prologue and
+    epilogue in h's empty region and extends it with a first free block.
+*/
+static int heap_init(mm_heap_t *h) {
+    //code is based off of Computer Systems Textbook, Section 9.9
+    //Dynamic Memory Allocation page 894, figure 9.44
+    char *heap_listp;
+
+    //create the intial empty heap
+    if((heap_listp = mem_region_sbrk(h->mem, 4 * WSIZE)) == (void *)-1) {
+        return -1;
+    }
+    PUT(heap_listp, 0);
+    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));
+    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));
+    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));
+    heap_listp += (2 * WSIZE);
+
+    h->heap_listp = heap_listp;
+    h->base = mem_region_lo(h->mem);
+    h->free_list = h->free_tail = 0;
+    h->fit_bound = 0;
+    h->rover = h->last_rem = 0;
+    h->last_bp = NULL;
+
+    //extend the empty heap with a free block of CHUNKSIZE bytes
+    if(extend_heap(h, CHUNKSIZE / WSIZE) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    The extend_heap function ensures that additional heap space
+    is retrieved from the memory and that the requested size is
+    rounded properly
+*/
+static void *extend_heap(mm_heap_t *h, size_t words) {
+    //code is borrowed from Computer Systems Textbook, Section 9.9
+    //Dynamic Memory Allocation page 894, figure 9.45
+
+    char *bp;
+    size_t size;
+
+    //allocate an even number of words to maintain alignment
+    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    if(size > INT_MAX ||
+       (long) (bp = mem_region_sbrk(h->mem, size)) == -1) {
+        return NULL;
+    }
+    STAT_INC(extends);
+    STAT_ADD(extend_bytes, size);
+
+    //initialize free block header/footer and the epilogue header; memlib
+    //keeps no pages above brk, so the new block starts out decommitted
+    PUT(HDRP(bp), PACK(size, DECOMMITTED));     /* free block header */
+    PUT(FTRP(bp), PACK(size, DECOMMITTED));     /* free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));       /* new epilogue header */
+
+    //coalesce if the previous block was free; a search that ran off the
+    //end of the list continues in the new block
+    bp = coalesce(h, bp);
+    if(h->rover == 0) {
+        h->rover = FREE_OFF(h, bp);
+    }
+    return bp;
+}
+
+/*
+    The place function will split the block if the remainder
+    of the block after splitting is still greater than or 
+    equal to the minimum block size. The remainder of a split
+    made for a small request becomes the heap's last remainder,
+    unless it is the top of the heap, which is left free to grow
+    the block below it in place, as in dlmalloc.
+*/
+static void place(mm_heap_t *h, void *bp, size_t asize) {
+    //code is based off of Computer Systems Textbook, Section 9.9
+    //Dynamic Memory Allocation page 920
+
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t decommitted = GET(HDRP(bp)) & DECOMMITTED;
+    int at_rover = h->rover == FREE_OFF(h, bp);
+    unsigned int prev = FREEBLK(bp)->prev, next = FREEBLK(bp)->next;
+
+    list_remove(h, bp);
+    if((csize - asize) >= (DSIZE * 2)) {
+        STAT_INC(splits);
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize - asize, decommitted));
+        PUT(FTRP(bp), PACK(csize - asize, decommitted));
+        //what is left of the block takes its place in the list
+        list_link(h, bp, prev, next);
+        //and the next search starts with it
+        if(at_rover) {
+            h->rover = FREE_OFF(h, bp);
+        }
+        if(asize <= LASTREM_MAX && GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) {
+            h->last_rem = FREE_OFF(h, bp);
+        }
+    } else {
+        PUT(HDRP(bp), PACK(csize, 1));
+        PUT(FTRP(bp), PACK(csize , 1));
+    }
+
+}
+
+/*  The find_fit function searches the explicit free list for a free
+    block that fits, next fit: from the rover to the end of the list, then
+    from the front of the list back to where the rover was. The list is in
+    address order, so this visits blocks in the same order as a walk over
+    the whole heap would. The wilderness is passed over and only used when
+    no other block fits, so it stays whole for large requests and for the
+    heap to grow into.
+*/
+static void *find_fit(mm_heap_t *h, size_t asize) {
+    //code is based off of Computer Systems Textbook, Section 9.9
+    //Dynamic Memory Allocation page 920
+    char *bp;
+    unsigned int off;
+    unsigned long scanned = 0;
+    unsigned int oldrover = h->rover;
+    unsigned int top = WILDERNESS(h);
+    size_t size, max = 0;
+
+    STAT_INC(fit_calls);
+
+    //a search that cannot succeed ends where a failed one would
+    if(asize > h->fit_bound) {
+        h->rover = 0;
+        goto wilderness;
+    }
+
+    //searches starting at the last block found
+    for(off = oldrover; off != 0; off = FREEBLK(bp)->next) {
+        bp = FREE_BLKP(h, off);
+        scanned++;
+        if(off != top && asize <= (size = GET_SIZE(HDRP(bp)))) {
+            STAT_SEARCH(scanned);
+            h->rover = off;
+            return bp;
+        }
+        max = off != top ? MAX(max, size) : max;
+    }
+    h->rover = 0;
+
+    //searches starting from the beginning to the last search
+    for(off = h->free_list; off != oldrover; off = FREEBLK(bp)->next) {
+        bp = FREE_BLKP(h, off);
+        scanned++;
+        if(off != top && asize <= (size = GET_SIZE(HDRP(bp)))) {
+            STAT_SEARCH(scanned);
+            return bp;
+        }
+        max = off != top ? MAX(max, size) : max;
+    }
+    h->fit_bound = max;
+
+wilderness:
+    STAT_SEARCH(scanned);
+    if(top != 0 && asize <= GET_SIZE(HDRP(FREE_BLKP(h, top)))) {
+        STAT_INC(fit_wilderness);
+        return FREE_BLKP(h, top);
+    }
+    STAT_INC(fit_misses);
+    return NULL;
+}
+
+//uses the boundary tag coalescing technique
+//uses the four cases from the textbook and is implemented below
+static void *coalesce(mm_heap_t *h, void *bp) {
+    //code is based off of Computer Systems Textbook, Section 9.9
+    //Dynamic Memory Allocation page 896, figure 9.46
+    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int rover = h->rover;
+
+    //case 1, next and prev both allocated
+    if(prev_alloc && next_alloc) {
+        STAT_INC(coalesce[0]);
+    }
+    //case 2, prev is allocated, and next is free
+    else if(prev_alloc && !next_alloc) {
+        STAT_INC(coalesce[1]);
+        list_remove(h, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+    //case 3, prev is free and next is allocated
+    else if(!prev_alloc && next_alloc) {
+        STAT_INC(coalesce[2]);
+        list_remove(h, PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        PUT(FTRP(bp), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        bp = PREV_BLKP(bp);
+    }
+    //case 4, previous and next are free
+    else {
+        STAT_INC(coalesce[3]);
+        list_remove(h, PREV_BLKP(bp));
+        list_remove(h, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        bp = PREV_BLKP(bp);
+    }
+
+    list_insert(h, bp);
+    //makes sure that rover is not left on a block that was merged into bp
+    if(rover != h->rover) {
+        h->rover = FREE_OFF(h, bp);
+    }
+    return bp;
+}
+
+//links the free block bp into h's free list, which is kept in address
+//order. bp's place is found by walking out over its allocated neighbours
+//in both directions until one side reaches a free block or the end of
+//the heap, which is usually a step or two.
+static void list_insert(mm_heap_t *h, char *bp) {
+    unsigned int prev, next;
+    char *lo = PREV_BLKP(bp), *hi = NEXT_BLKP(bp);
+
+    for(;;) {
+        if(lo == h->heap_listp) {
+            prev = 0;
+            next = h->free_list;
+            break;
+        }
+        if(!GET_ALLOC(HDRP(lo))) {
+            prev = FREE_OFF(h, lo);
+            next = FREEBLK(lo)->next;
+            break;
+        }
+        if(GET_SIZE(HDRP(hi)) == 0) {
+            prev = h->free_tail;
+            next = 0;
+            break;
+        }
+        if(!GET_ALLOC(HDRP(hi))) {
+            prev = FREEBLK(hi)->prev;
+            next = FREE_OFF(h, hi);
+            break;
+        }
+        lo = PREV_BLKP(lo);
+        hi = NEXT_BLKP(hi);
+    }
+    list_link(h, bp, prev, next);
+}
+
+//links the free block bp into h's free list between prev and next
+static void list_link(mm_heap_t *h, char *bp, unsigned int prev,
+                      unsigned int next) {
+    unsigned int off = FREE_OFF(h, bp);
+
+    if(GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) {
+        h->fit_bound = MAX(h->fit_bound, GET_SIZE(HDRP(bp)));
+    }
+    FREEBLK(bp)->next = next;
+    FREEBLK(bp)->prev = prev;
+    if(prev != 0) {
+        FREEBLK(FREE_BLKP(h, prev))->next = off;
+    } else {
+        h->free_list = off;
+    }
+    if(next != 0) {
+        FREEBLK(FREE_BLKP(h, next))->prev = off;
+    } else {
+        h->free_tail = off;
+    }
+}
+
+//unlinks the free block bp from h's free list
+static void list_remove(mm_heap_t *h, char *bp) {
+    freeblock_t *f = FREEBLK(bp);
+
+    if(h->rover == FREE_OFF(h, bp)) {
+        h->rover = f->next;
+    }
+    if(h->last_rem == FREE_OFF(h, bp)) {
+        h->last_rem = 0;
+    }
+    if(f->prev != 0) {
+        FREEBLK(FREE_BLKP(h, f->prev))->next = f->next;
+    } else {
+        h->free_list = f->next;
+    }
+    if(f->next != 0) {
+        FREEBLK(FREE_BLKP(h, f->next))->prev = f->prev;
+    } else {
+        h->free_tail = f->prev;
+    }
+}
+
+/*
+ * mm_stats - copies the event counters into st. Returns 0, or -1 (and
+ * zeroes st) when mm.c was built without MM_STATS.
+ */
+int mm_stats(mm_stats_t *st) {
+#if MM_STATS
+    *st = stats;
+    return 0;
+#else
+    memset(st, 0, sizeof(*st));
+    return -1;
+#endif
+}
+
+/*
+ * mm_stats_print - prints a short summary of the event counters to fp
+ */
+void mm_stats_print(FILE *fp) {
+    mm_stats_t st;
+    int i;
+
+    if(mm_stats(&st) < 0) {
+        fprintf(fp, "  (mm.c built without MM_STATS)\n");
+        return;
+    }
+    fprintf(fp, "  malloc %lu, free %lu, realloc %lu\n",
+            st.mallocs, st.frees, st.reallocs);
+    fprintf(fp, "  find_fit %lu calls, %lu misses, %lu from the wilderness, "
+            "%lu blocks scanned (%.1f per call)\n", st.fit_calls,
+            st.fit_misses, st.fit_wilderness, st.fit_scanned,
+            st.fit_calls ? (double)st.fit_scanned / st.fit_calls : 0.0);
+    fprintf(fp, "  splits %lu, last remainder hits %lu, extend_heap %lu "
+            "(%lu bytes)\n", st.splits, st.lastrem_hits, st.extends,
+            st.extend_bytes);
+    fprintf(fp, "  coalesce cases 1:%lu 2:%lu 3:%lu 4:%lu\n",
+            st.coalesce[0], st.coalesce[1], st.coalesce[2], st.coalesce[3]);
+    fprintf(fp, "  decommits %lu (%lu bytes), reused decommitted blocks %lu\n",
+            st.decommits, st.decommit_bytes, st.recommits);
+    fprintf(fp, "  search length");
+    for(i = 0; i < MM_STATS_HIST; i++) {
+        if(i < 2) {
+            fprintf(fp, " %d:%lu", i, st.search_hist[i]);
+        } else if(i < MM_STATS_HIST - 1) {
+            fprintf(fp, " %lu-%lu:%lu", 1UL << (i - 1), (1UL << i) - 1,
+                    st.search_hist[i]);
+        } else {
+            fprintf(fp, " %lu+:%lu", 1UL << (i - 1), st.search_hist[i]);
+        }
+    }
+    fprintf(fp, "\n");
+}
+
+#if MM_STATS
+//records the number of blocks one find_fit call looked at
+static void stat_search(unsigned long n) {
+    int bucket = 0;
+
+    stats.fit_scanned += n;
+    while(n && bucket < MM_STATS_HIST - 1) {
+        n >>= 1;
+        bucket++;
+    }
+    stats.search_hist[bucket]++;
+}
+#endif
@@ -1,10 +1,161 @@
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Independent heaps. Each mm_heap_t grows into its own simulated memory
+ * region, so heaps never share blocks and mm_heap_destroy() releases a
+ * whole heap at once. mm_malloc and friends use a default heap in the
+ * memlib default region.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(void);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+
+/*
+ * Relocatable allocations in the default heap. A handle's data may be
+ * moved by mm_compact() unless it is pinned: mm_hlock() returns the
+ * current address and keeps it valid until the matching mm_hunlock().
+ * mm_compact() returns the number of bytes the heap shrank by.
+ */
+typedef unsigned int mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hlock(mm_handle_t h);
+extern void mm_hunlock(mm_handle_t h);
+extern void mm_hfree(mm_handle_t h);
+extern size_t mm_compact(void);
+
+/*
+ * mm_reserve() grows the default heap by enough to serve bytes bytes of
+ * requests and faults the new pages in up front; call it at startup.
+ */
+extern int mm_reserve(size_t bytes);
+
+/*
+ * Background maintenance of the default heap. While it runs, mm_free only
+ * queues blocks, and a thread frees them and trims the heap for at most
+ * duty percent of every period_us microseconds. mm_init must not be
+ * called between mm_maint_start() and mm_maint_stop().
+ */
+extern int mm_maint_start(unsigned int period_us, unsigned int duty);
+extern void mm_maint_stop(void);
+
+/*
+ * Caches of small free blocks in front of the default heap, which also
+ * make mm_malloc, mm_free, mm_realloc, mm_compact, mm_release and
+ * mm_reserve and the handle functions safe to call from several
+ * threads, as mm_maint_start() does; the setup calls stay single threaded.
+ * MM_CACHES_CPU keeps one cache per CPU using Linux restartable
+ * sequences and falls back to MM_CACHES_THREAD, one cache per thread,
+ * where those are not available. mm_caches() returns the mode in effect
+ * and must be called while no other thread uses the heap.
+ */
+#define MM_CACHES_OFF 0
+#define MM_CACHES_THREAD 1
+#define MM_CACHES_CPU 2
+
+extern int mm_caches(int mode);
+
+/*
+ * Per-thread caches size themselves: each size grows while it misses and
+ * shrinks when its blocks sit unused, and a thread's cache is flushed
+ * when the thread exits. mm_caches_limit() caps the bytes held by all
+ * per-thread caches together.
+ */
+extern void mm_caches_limit(size_t bytes);
+
+/*
+ * Epoch-based reclamation for lock-free data structures in the default
+ * heap. Readers bracket their traversals with mm_epoch_enter() and
+ * mm_epoch_exit(), and a block that has been unlinked is handed to
+ * mm_free_deferred() instead of mm_free(). Deferred blocks are freed in
+ * batches once every thread has left the critical sections that might
+ * still see them. mm_epoch_flush() frees whatever is safe by now,
+ * including blocks of threads that have exited, and returns the count.
+ */
+extern void mm_epoch_enter(void);
+extern void mm_epoch_exit(void);
+extern void mm_free_deferred(void *ptr);
+extern size_t mm_epoch_flush(void);
+
+/*
+ * Returning the pages inside free blocks to the system. After
+ * mm_release_threshold(n), mm_free releases the pages of the free blocks
+ * of n bytes or more it leaves below the top of the heap. mm_release()
+ * releases those of every free block in the default heap and returns the
+ * number of bytes released.
+ */
+extern void mm_release_threshold(size_t bytes);
+extern size_t mm_release(void);
+
+/*
+ * Gradual release: after mm_decay(ms), free pages of the default heap are
+ * released along a smooth curve over the ms milliseconds after they were
+ * freed. mm_decay_clock() replaces the microsecond clock this uses, so a
+ * replay can run on simulated time; NULL restores the real one.
+ */
+extern void mm_decay(unsigned long decay_ms);
+extern void mm_decay_clock(unsigned long (*now_us)(void));
+
+/*
+ * Heap consistency checking. mm_check() walks the whole heap, while
+ * mm_check_last() only looks at the block touched by the last request
+ * and its neighbours. Both report to stderr and return 0 on a problem.
+ */
+extern int mm_check(void);
+extern int mm_check_last(void);
+
+/*
+ * Writes a page occupancy map of the heap to fp as a binary PPM image,
+ * one pixel per page: red is boundary tag bytes, green is allocated
+ * bytes and blue is free bytes, each scaled to the page size.
+ */
+extern int mm_heapmap(FILE *fp);
+
+/*
+ * Allocator event counters. They are only compiled into mm.c when it is
+ * built with -DMM_STATS=1 (see the Makefile); otherwise mm_stats() returns
+ * -1 and the hot paths carry no counting code at all. The counters are
+ * reset by mm_init().
+ */
+#define MM_STATS_HIST 12    /* buckets in the search length histogram */
+
+typedef struct {
+    unsigned long mallocs;          /* mm_malloc calls (nonzero size) */
+    unsigned long frees;            /* mm_free calls (non-NULL) */
+    unsigned long reallocs;         /* mm_realloc calls */
+    unsigned long fit_calls;        /* find_fit calls */
+    unsigned long fit_misses;       /* find_fit calls that found nothing */
+    unsigned long fit_wilderness;   /* find_fit calls that fell back on the
+                                       free block at the top of the heap */
+    unsigned long fit_scanned;      /* blocks examined by find_fit */
+    unsigned long splits;           /* place() calls that split a block */
+    unsigned long lastrem_hits;     /* mallocs served from the last remainder */
+    unsigned long coalesce[4];      /* coalesce() cases 1-4 */
+    unsigned long extends;          /* extend_heap calls */
+    unsigned long extend_bytes;     /* bytes added by extend_heap */
+    unsigned long decommits;        /* free blocks whose pages were released */
+    unsigned long decommit_bytes;   /* bytes released by those */
+    unsigned long recommits;        /* allocations from decommitted blocks */
+    /* blocks scanned per find_fit: 0, 1, 2-3, 4-7, ..., >= 2^(HIST-2) */
+    unsigned long search_hist[MM_STATS_HIST];
+} mm_stats_t;
+
+extern int mm_stats(mm_stats_t *st);
+extern void mm_stats_print(FILE *fp);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
@@ -21,3 +172,6 @@ typedef struct {
 
 extern team_t team;
 
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+ * mmarena.c - region (arena) allocation on top of the mm package
+ *
+ * Each arena is a list of chunks obtained with mm_malloc, in the order
+ * they are filled. The arena's own bookkeeping lives at the start of its
+ * first chunk, so creating an arena costs a single mm_malloc. Allocation
+ * bumps cur towards end in the current chunk; a request that does not
+ * fit moves on to the next chunk, or puts a new one in front of it,
+ * sized to fit if it is larger than the arena's chunk size.
+ *
+ * A reset only rewinds to the first chunk and keeps the others for the
+ * next round to fill again, so neither the reset nor the round after it
+ * calls into the heap. Only an arena holding more than ARENA_KEEP bytes
+ * of chunks hands the ones past that back on a reset.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mm.h"
+#include "mmarena.h"
+
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+#define ARENA_CHUNKSIZE (1<<12)     //default bytes per chunk
+#define ARENA_KEEP (1<<20)          //chunk bytes a reset keeps, at most
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+//chunk header, followed by the chunk's data
+typedef struct chunk {
+    struct chunk *next;             //chunk filled after this one
+    size_t size;                    //bytes of data in this chunk
+} chunk_t;
+
+struct mm_arena {
+    chunk_t first;                  //header of the chunk holding the arena
+    chunk_t *head;                  //chunk being filled
+    char *cur;                      //next free byte in head
+    char *end;                      //end of head's data
+    size_t chunksize;               //data bytes per ordinary chunk
+    size_t kept;                    //data bytes in all chunks
+};
+
+#define FIRST_DATA(a) ((char *)(a) + ALIGN(sizeof(mm_arena_t)))
+#define CHUNK_DATA(c) ((char *)(c) + ALIGN(sizeof(chunk_t)))
+
+/*
+ * mm_arena_create - makes an arena whose chunks hold chunksize bytes
+ * (0 selects the default). Returns NULL if mm_malloc fails.
+ */
+mm_arena_t *mm_arena_create(size_t chunksize) {
+    mm_arena_t *a;
+
+    chunksize = ALIGN(chunksize ? chunksize : ARENA_CHUNKSIZE);
+    if((a = mm_malloc(ALIGN(sizeof(mm_arena_t)) + chunksize)) == NULL) {
+        return NULL;
+    }
+    a->first.next = NULL;
+    a->first.size = chunksize;
+    a->chunksize = chunksize;
+    a->kept = chunksize;
+    mm_arena_reset(a);
+    return a;
+}
+
+/*
+ * mm_arena_alloc - bump allocates size bytes, aligned like mm_malloc
+ */
+void *mm_arena_alloc(mm_arena_t *a, size_t size) {
+    chunk_t *c;
+    size_t csize;
+    char *p;
+
+    size = ALIGN(size);
+    if((size_t)(a->end - a->cur) >= size) {
+        p = a->cur;
+        a->cur += size;
+        return p;
+    }
+
+    //move on to the next chunk if it is big enough, or else start a new
+    //one in front of it, sized to fit oversized requests
+    if((c = a->head->next) == NULL || c->size < size) {
+        csize = MAX(size, a->chunksize);
+        if((c = mm_malloc(ALIGN(sizeof(chunk_t)) + csize)) == NULL) {
+            return NULL;
+        }
+        c->size = csize;
+        c->next = a->head->next;
+        a->head->next = c;
+        a->kept += csize;
+    }
+    a->head = c;
+    p = CHUNK_DATA(c);
+    a->cur = p + size;
+    a->end = p + c->size;
+    return p;
+}
+
+/*
+ * mm_arena_reset - frees everything allocated from the arena by starting
+ * over in its first chunk. The chunks past the first ARENA_KEEP bytes of
+ * them go back to the heap.
+ */
+void mm_arena_reset(mm_arena_t *a) {
+    chunk_t *c, *next;
+    size_t n;
+
+    if(a->kept > ARENA_KEEP) {
+        for(c = &a->first, n = c->size; c->next != NULL; ) {
+            next = c->next;
+            if(n + next->size > ARENA_KEEP) {
+                c->next = next->next;
+                a->kept -= next->size;
+                mm_free(next);
+            } else {
+                n += next->size;
+                c = next;
+            }
+        }
+    }
+    a->head = &a->first;
+    a->cur = FIRST_DATA(a);
+    a->end = a->cur + a->first.size;
+}
+
+/*
+ * mm_arena_destroy - frees every chunk and the arena itself
+ */
+void mm_arena_destroy(mm_arena_t *a) {
+    chunk_t *c, *next;
+
+    for(c = a->first.next; c != NULL; c = next) {
+        next = c->next;
+        mm_free(c);
+    }
+    mm_free(a);
+}
@@ -0,0 +1,25 @@
+/*
+ * mmarena.h - region (arena) allocation on top of the mm package
+ *
+ * An arena hands out memory by bumping a pointer through chunks it
+ * obtains with mm_malloc. Objects are never freed individually: a
+ * reset frees them all at once by rewinding to the first chunk and
+ * keeping the others for reuse, and destroy returns every chunk and the
+ * arena itself to the heap.
+ */
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mm_arena mm_arena_t;
+
+mm_arena_t *mm_arena_create(size_t chunksize);
+void *mm_arena_alloc(mm_arena_t *a, size_t size);
+void mm_arena_reset(mm_arena_t *a);
+void mm_arena_destroy(mm_arena_t *a);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,273 @@
+/*
+ * mmcache.c - slab object caches for fixed-size objects
+ *
+ * Modeled on Bonwick's kmem_cache. Each cache owns a memlib region and
+ * grows it one slab at a time with mem_region_sbrk. Slabs are aligned
+ * to their own size, so the slab holding an object is found by masking
+ * its address. A slab starts with its slab_t header, then a color offset,
+ * then its buffers:
+ *
+ *     | slab_t | color | obj link | obj link | ... | obj link | unused |
+ *
+ * Each buffer is the object followed by the free list link, so linking a
+ * free object never overwrites its constructed state. Successive slabs
+ * use successive color offsets, in cache line steps, so the first lines
+ * of different slabs map to different cache sets.
+ *
+ * Every cache keeps its slabs on three lists: partial slabs, which are
+ * preferred for allocation, full slabs, and empty slabs kept for reuse.
+ * The partial and empty lists are kept in address order, so objects are
+ * handed out from the lowest slabs first. The busy objects of a cache
+ * then stay packed into as few of its region's huge pages as possible.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "memlib.h"
+#include "mmcache.h"
+
+#define CACHELINE 64            //smallest step between slab colors
+#define MINOBJS 8               //objects a slab must hold at least
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+//slab header, at the start of every slab
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    void *free;                 //first free buffer
+    unsigned inuse;             //objects handed out
+    size_t color;               //offset of the first buffer past the header
+} slab_t;
+
+struct mm_cache {
+    size_t objsize;             //object size, rounded to align
+    size_t bufsize;             //object plus free list link
+    size_t align;
+    void (*ctor)(void *);
+    void (*dtor)(void *);
+    mem_region_t *mem;          //region the slabs are carved from
+    size_t slabsize;            //power of two, slabs are aligned to it
+    unsigned perslab;           //buffers per slab
+    size_t color;               //color offset of the next slab
+    size_t maxcolor;            //largest color that still fits
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+};
+
+//the free list link stored right after each object
+#define LINK(c, obj) (*(void **)((char *)(obj) + (c)->objsize))
+#define SLAB_OF(c, obj) ((slab_t *)((uintptr_t)(obj) & ~((c)->slabsize - 1)))
+#define FIRST_BUF(c, s, color) \
+    ((char *)(s) + ALIGN_UP(sizeof(slab_t), (c)->align) + (color))
+
+static slab_t *slab_create(mm_cache_t *c);
+static void slab_push(slab_t **list, slab_t *s);
+static void slab_insert(slab_t **list, slab_t *s);
+static void slab_unlink(slab_t **list, slab_t *s);
+static void slab_destroy(mm_cache_t *c, slab_t *s);
+
+/*
+ * mm_cache_create - makes a cache of size byte objects aligned to align
+ * (a power of two, 0 for the default of 8). Returns NULL on failure.
+ */
+mm_cache_t *mm_cache_create(size_t size, size_t align,
+                            void (*ctor)(void *), void (*dtor)(void *)) {
+    mm_cache_t *c;
+    size_t hdr, pagesize = mem_pagesize();
+
+    align = MAX(align, sizeof(void *));
+    if(size == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if((c = calloc(1, sizeof(mm_cache_t))) == NULL) {
+        return NULL;
+    }
+    if((c->mem = mem_region_create()) == NULL) {
+        free(c);
+        return NULL;
+    }
+    c->align = align;
+    c->objsize = ALIGN_UP(size, sizeof(void *));
+    c->bufsize = ALIGN_UP(c->objsize + sizeof(void *), align);
+    c->ctor = ctor;
+    c->dtor = dtor;
+
+    //smallest power of two slab, at least a page, holding MINOBJS buffers
+    hdr = ALIGN_UP(sizeof(slab_t), align);
+    c->slabsize = pagesize;
+    while(c->slabsize < hdr + MINOBJS * c->bufsize) {
+        c->slabsize <<= 1;
+    }
+    c->perslab = (c->slabsize - hdr) / c->bufsize;
+    c->maxcolor = c->slabsize - hdr - c->perslab * c->bufsize;
+    return c;
+}
+
+/*
+ * mm_cache_alloc - returns a constructed object, or NULL if the cache's
+ * region is exhausted
+ */
+void *mm_cache_alloc(mm_cache_t *c) {
+    slab_t *s = c->partial;
+    void *obj;
+
+    if(s == NULL) {
+        if((s = c->empty) != NULL) {
+            slab_unlink(&c->empty, s);
+        } else if((s = slab_create(c)) == NULL) {
+            return NULL;
+        }
+        slab_push(&c->partial, s);
+    }
+
+    obj = s->free;
+    s->free = LINK(c, obj);
+    if(++s->inuse == c->perslab) {
+        slab_unlink(&c->partial, s);
+        slab_push(&c->full, s);
+    }
+    return obj;
+}
+
+/*
+ * mm_cache_free - returns obj to its slab, still in constructed state
+ */
+void mm_cache_free(mm_cache_t *c, void *obj) {
+    slab_t *s;
+
+    if(obj == NULL) {
+        return;
+    }
+    s = SLAB_OF(c, obj);
+    LINK(c, obj) = s->free;
+    s->free = obj;
+
+    if(s->inuse-- == c->perslab) {
+        slab_unlink(&c->full, s);
+        slab_insert(s->inuse ? &c->partial : &c->empty, s);
+    } else if(s->inuse == 0) {
+        slab_unlink(&c->partial, s);
+        slab_insert(&c->empty, s);
+    }
+}
+
+/*
+ * mm_cache_destroy - runs the destructor on every object the cache ever
+ * constructed and releases its region
+ */
+void mm_cache_destroy(mm_cache_t *c) {
+    slab_t **lists[3] = { &c->partial, &c->full, &c->empty };
+    slab_t *s;
+    int i;
+
+    for(i = 0; i < 3; i++) {
+        while((s = *lists[i]) != NULL) {
+            slab_unlink(lists[i], s);
+            slab_destroy(c, s);
+        }
+    }
+    mem_region_destroy(c->mem);
+    free(c);
+}
+
+/*
+    The slab_create function carves a new slab out of the cache's region,
+    aligned to the slab size, and constructs all of its objects.
+*/
+static slab_t *slab_create(mm_cache_t *c) {
+    char *brk = mem_region_sbrk(c->mem, 0);
+    size_t pad = (-(uintptr_t)brk) & (c->slabsize - 1);
+    slab_t *s;
+    char *buf;
+    unsigned i;
+
+    if(mem_region_sbrk(c->mem, pad + c->slabsize) == (void *)-1) {
+        return NULL;
+    }
+    s = (slab_t *)(brk + pad);
+    s->next = s->prev = NULL;
+    s->inuse = 0;
+    s->free = NULL;
+    s->color = c->color;
+
+    //build the free list back to front so buffers go out in address order
+    buf = FIRST_BUF(c, s, c->color);
+    for(i = c->perslab; i > 0; i--) {
+        char *obj = buf + (i - 1) * c->bufsize;
+
+        if(c->ctor) {
+            c->ctor(obj);
+        }
+        LINK(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    //the next slab starts its buffers one cache line further in
+    c->color += MAX(c->align, CACHELINE);
+    if(c->color > c->maxcolor) {
+        c->color = 0;
+    }
+    return s;
+}
+
+/*
+    The slab_destroy function runs the destructor on every buffer of a
+    slab. Slabs are never returned to the region individually.
+*/
+static void slab_destroy(mm_cache_t *c, slab_t *s) {
+    char *buf = FIRST_BUF(c, s, s->color);
+    unsigned i;
+
+    if(c->dtor == NULL) {
+        return;
+    }
+    for(i = 0; i < c->perslab; i++, buf += c->bufsize) {
+        c->dtor(buf);
+    }
+}
+
+//pushes s on the front of a doubly linked slab list
+static void slab_push(slab_t **list, slab_t *s) {
+    s->prev = NULL;
+    s->next = *list;
+    if(*list) {
+        (*list)->prev = s;
+    }
+    *list = s;
+}
+
+//inserts s into a doubly linked slab list kept in address order
+static void slab_insert(slab_t **list, slab_t *s) {
+    slab_t *prev = NULL, *next = *list;
+
+    while(next != NULL && next < s) {
+        prev = next;
+        next = next->next;
+    }
+    s->prev = prev;
+    s->next = next;
+    if(prev) {
+        prev->next = s;
+    } else {
+        *list = s;
+    }
+    if(next) {
+        next->prev = s;
+    }
+}
+
+//removes s from a doubly linked slab list
+static void slab_unlink(slab_t **list, slab_t *s) {
+    if(s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if(s->next) {
+        s->next->prev = s->prev;
+    }
+}
@@ -0,0 +1,25 @@
+/*
+ * mmcache.h - slab object caches for fixed-size objects
+ *
+ * A cache hands out objects of one size that are kept in constructed
+ * state: ctor runs once when a slab is created and dtor only when the
+ * cache is destroyed, so mm_cache_free and mm_cache_alloc never
+ * reinitialize an object. Either function pointer may be NULL.
+ */
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mm_cache mm_cache_t;
+
+mm_cache_t *mm_cache_create(size_t size, size_t align,
+                            void (*ctor)(void *), void (*dtor)(void *));
+void *mm_cache_alloc(mm_cache_t *c);
+void mm_cache_free(mm_cache_t *c, void *obj);
+void mm_cache_destroy(mm_cache_t *c);
+
+#ifdef __cplusplus
+}
+#endif
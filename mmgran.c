@@ -0,0 +1,414 @@
+/*
+ * mmgran.c - granule bitmaps for medium requests in the mm package
+ *
+ * The reservation is MM_GRAN_SPANS spans of 2^MM_GRAN_SHIFT bytes in one
+ * memlib region, taken from its brk one at a time as the earlier ones
+ * fill up. Span i is described by spans[i], outside the reservation:
+ *
+ *     used  | 1 1 1 0 0 0 0 1 1 0 ... |   granules in an object
+ *     last  | 0 0 1 0 0 0 0 0 1 0 ... |   granules ending one
+ *
+ * so an object of n granules is a run of n set bits in used whose last
+ * one is also set in last, and mm_gran_free finds where it ends with a
+ * bit scan. mm_gran_malloc looks for a run of n clear bits in used,
+ * first in the span it last allocated from and then in the others. Each
+ * span keeps an upper bound on its longest run, lowered when a search
+ * fails and raised by frees, so the spans that cannot have room are not
+ * searched at all.
+ *
+ * The run search is picked for the CPU by mm_gran_start. Runs inside a
+ * word are found with log2(n) shift-and steps, and runs across words by
+ * counting the clear bits at their ends. The AVX-512 and AVX2 versions
+ * take 512 or 256 bits of a bitmap at once: they skip them if they are
+ * all set or all clear, which is most of a bitmap that is nearly full or
+ * nearly empty, and otherwise do the shift-and steps for all their words
+ * together, leaving only the ends of the words to be followed one by one.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "memlib.h"
+#include "mmgran.h"
+
+#define SPAN_BYTES ((size_t)1 << MM_GRAN_SHIFT)
+#define GRANULES (SPAN_BYTES / MM_GRAN_SIZE)    //granules in a span
+#define WORDS (GRANULES / 64)                   //64-bit words in a bitmap
+#define NO_RUN INT_MIN                          //word_run found nothing
+#define RESERVE_ALIGN ((size_t)1 << 21)         //a transparent huge page
+
+typedef struct gran_span {
+    uint64_t used[WORDS];           //1 for each granule in an object
+    uint64_t last[WORDS];           //1 for the last granule of each object
+    unsigned maxrun;                //no run of clear bits in used is
+                                    //longer than this
+} __attribute__((aligned(64))) gran_span_t;
+
+int mm_gran_on;
+char *mm_gran_base;
+size_t mm_gran_span;
+
+static gran_span_t spans[MM_GRAN_SPANS];
+static unsigned nspans;             //spans taken from the region so far
+static unsigned cur;                //span the last object came from
+static mem_region_t *mem;
+
+//the run search mm_gran_start picked, and its name
+static int (*find_run)(const uint64_t *used, unsigned n);
+static const char *search_name;
+
+static int find_run_scalar(const uint64_t *used, unsigned n);
+#if defined(__x86_64__) || defined(__i386__)
+static int find_run_avx2(const uint64_t *used, unsigned n);
+static int find_run_avx512(const uint64_t *used, unsigned n);
+#endif
+static void *take(unsigned i, unsigned g, unsigned n);
+static unsigned object_granules(gran_span_t *s, unsigned g);
+static unsigned run_through(const uint64_t *used, unsigned g);
+static void set_bits(uint64_t *map, unsigned g, unsigned n, int on);
+
+/*
+ * mm_gran_start - serve medium requests from the spans. The reservation
+ * is made, and the run search picked, by the first call. Returns -1 if
+ * the reservation cannot be set up.
+ */
+int mm_gran_start(void) {
+    size_t bytes = MM_GRAN_SPANS * SPAN_BYTES;
+    char *base;
+
+    if(mm_gran_base == NULL) {
+        if((base = mem_reserve(bytes, RESERVE_ALIGN)) == NULL) {
+            return -1;
+        }
+        if((mem = mem_region_create_at(base, bytes)) == NULL) {
+            munmap(base, bytes);
+            return -1;
+        }
+        find_run = find_run_scalar;
+        search_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) {
+            find_run = find_run_avx512;
+            search_name = "avx512";
+        } else if(__builtin_cpu_supports("avx2")) {
+            find_run = find_run_avx2;
+            search_name = "avx2";
+        }
+#endif
+        mm_gran_base = base;
+        mm_gran_span = bytes;
+    }
+    mm_gran_on = 1;
+    return 0;
+}
+
+/*
+ * mm_gran_stop - send medium requests to the heap again. Objects already
+ * in the spans stay there until they are freed.
+ */
+void mm_gran_stop(void) {
+    mm_gran_on = 0;
+}
+
+/*
+ * mm_gran_reset - give back every span. Called by mm_init, which drops
+ * all the blocks of the default heap at once.
+ */
+void mm_gran_reset(void) {
+    if(mm_gran_base != NULL) {
+        mem_region_reset_brk(mem);
+    }
+    nspans = 0;
+    cur = 0;
+}
+
+/*
+ * mm_gran_heapsize - bytes of all the spans taken so far
+ */
+size_t mm_gran_heapsize(void) {
+    return mm_gran_base != NULL ? mem_region_heapsize(mem) : 0;
+}
+
+/*
+ * mm_gran_search - name of the run search in use, NULL before the first
+ * mm_gran_start
+ */
+const char *mm_gran_search(void) {
+    return search_name;
+}
+
+/*
+ * mm_gran_malloc - slow path of mm_malloc for MM_GRAN_MIN to MM_GRAN_MAX
+ * bytes. Returns NULL if no span has room and the reservation is used up.
+ */
+void *mm_gran_malloc(size_t size) {
+    unsigned n = (size + MM_GRAN_SIZE - 1) / MM_GRAN_SIZE;
+    unsigned i, k;
+    int g;
+
+    for(k = 0, i = cur; k < nspans; k++, i = i + 1 < nspans ? i + 1 : 0) {
+        if(spans[i].maxrun < n) {
+            continue;
+        }
+        if((g = find_run(spans[i].used, n)) >= 0) {
+            cur = i;
+            return take(i, g, n);
+        }
+        spans[i].maxrun = n - 1;
+    }
+    if(nspans == MM_GRAN_SPANS ||
+       mem_region_sbrk(mem, SPAN_BYTES) == (void *)-1) {
+        return NULL;
+    }
+    memset(&spans[nspans], 0, sizeof(gran_span_t));
+    spans[nspans].maxrun = GRANULES;
+    cur = nspans++;
+    return take(cur, 0, n);
+}
+
+/*
+ * mm_gran_free - clear an object's bits in its span
+ */
+void mm_gran_free(void *bp) {
+    size_t off = (char *)bp - mm_gran_base;
+    gran_span_t *s = &spans[off >> MM_GRAN_SHIFT];
+    unsigned g = (off & (SPAN_BYTES - 1)) / MM_GRAN_SIZE;
+    unsigned n = object_granules(s, g);
+
+    s->last[(g + n - 1) / 64] &= ~(1ULL << (g + n - 1) % 64);
+    set_bits(s->used, g, n, 0);
+    if((n = run_through(s->used, g)) > s->maxrun) {
+        s->maxrun = n;
+    }
+}
+
+/*
+ * mm_gran_size - bytes of the granules of an object
+ */
+size_t mm_gran_size(void *bp) {
+    size_t off = (char *)bp - mm_gran_base;
+
+    return object_granules(&spans[off >> MM_GRAN_SHIFT],
+                           (off & (SPAN_BYTES - 1)) / MM_GRAN_SIZE) *
+        MM_GRAN_SIZE;
+}
+
+/*
+ * extends the run of clear bits carried in *run, which ends where word w
+ * of a bitmap starts, over w; starts has a bit set wherever n clear bits
+ * of w start inside w. Returns the bit, counted from w's first, at which
+ * the first run of n clear bits starts (negative if it starts in an
+ * earlier word), or NO_RUN if none ends in w; in that case *run becomes
+ * the clear bits at w's end.
+ */
+static inline int word_run(uint64_t w, uint64_t starts, unsigned n,
+                           unsigned *run) {
+    if(w == 0) {
+        if(*run + 64 >= n) {
+            return -(int)*run;
+        }
+        *run += 64;
+        return NO_RUN;
+    }
+    if(*run + __builtin_ctzll(w) >= n) {
+        return -(int)*run;
+    }
+    if(starts != 0) {
+        return __builtin_ctzll(starts);
+    }
+    *run = __builtin_clzll(w);
+    return NO_RUN;
+}
+
+//the starts of the runs of n clear bits inside w, for word_run: each
+//shift-and step doubles the length a set bit stands for
+static inline uint64_t word_starts(uint64_t w, unsigned n) {
+    uint64_t x = ~w;
+    unsigned k, t;
+
+    if(n > 64) {
+        return 0;
+    }
+    for(k = 1; k < n; k += t) {
+        t = k < n - k ? k : n - k;
+        x &= x >> t;
+    }
+    return x;
+}
+
+//returns the first granule of the first run of n clear bits, or -1
+static int find_run_scalar(const uint64_t *used, unsigned n) {
+    unsigned run = 0;
+    int i, s;
+
+    for(i = 0; i < WORDS; i++) {
+        if((s = word_run(used[i], word_starts(used[i], n), n, &run)) !=
+           NO_RUN) {
+            return i * 64 + s;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//find_run_scalar four words at a time, skipping them where it can
+__attribute__((target("avx2")))
+static int find_run_avx2(const uint64_t *used, unsigned n) {
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    uint64_t starts[4] __attribute__((aligned(32)));
+    __m256i v, x;
+    unsigned run = 0, k, t;
+    int i, j, s;
+
+    for(i = 0; i < WORDS; i += 4) {
+        v = _mm256_load_si256((const __m256i *)(used + i));
+        if(_mm256_testc_si256(v, ones)) {
+            run = 0;
+            continue;
+        }
+        if(_mm256_testz_si256(v, v)) {
+            if(run + 256 >= n) {
+                return i * 64 - run;
+            }
+            run += 256;
+            continue;
+        }
+        //word_starts of all four words
+        x = _mm256_setzero_si256();
+        if(n <= 64) {
+            x = _mm256_xor_si256(v, ones);
+            for(k = 1; k < n; k += t) {
+                t = k < n - k ? k : n - k;
+                x = _mm256_and_si256(x,
+                                     _mm256_srl_epi64(x, _mm_cvtsi32_si128(t)));
+            }
+        }
+        _mm256_store_si256((__m256i *)starts, x);
+        for(j = 0; j < 4; j++) {
+            if((s = word_run(used[i + j], starts[j], n, &run)) != NO_RUN) {
+                return (i + j) * 64 + s;
+            }
+        }
+    }
+    return -1;
+}
+
+//find_run_scalar eight words at a time, skipping them where it can
+__attribute__((target("avx512f")))
+static int find_run_avx512(const uint64_t *used, unsigned n) {
+    const __m512i ones = _mm512_set1_epi64(-1);
+    uint64_t starts[8] __attribute__((aligned(64)));
+    __m512i v, x;
+    unsigned run = 0, k, t;
+    int i, j, s;
+
+    for(i = 0; i < WORDS; i += 8) {
+        v = _mm512_load_si512((const void *)(used + i));
+        if(_mm512_cmpneq_epi64_mask(v, ones) == 0) {
+            run = 0;
+            continue;
+        }
+        if(_mm512_test_epi64_mask(v, v) == 0) {
+            if(run + 512 >= n) {
+                return i * 64 - run;
+            }
+            run += 512;
+            continue;
+        }
+        //word_starts of all eight words
+        x = _mm512_setzero_si512();
+        if(n <= 64) {
+            x = _mm512_xor_si512(v, ones);
+            for(k = 1; k < n; k += t) {
+                t = k < n - k ? k : n - k;
+                x = _mm512_and_si512(x,
+                                     _mm512_srl_epi64(x, _mm_cvtsi32_si128(t)));
+            }
+        }
+        _mm512_store_si512((void *)starts, x);
+        for(j = 0; j < 8; j++) {
+            if((s = word_run(used[i + j], starts[j], n, &run)) != NO_RUN) {
+                return (i + j) * 64 + s;
+            }
+        }
+    }
+    return -1;
+}
+#endif
+
+//marks granules g to g + n - 1 of span i as an object and returns it
+static void *take(unsigned i, unsigned g, unsigned n) {
+    gran_span_t *s = &spans[i];
+
+    set_bits(s->used, g, n, 1);
+    s->last[(g + n - 1) / 64] |= 1ULL << (g + n - 1) % 64;
+    return mm_gran_base + i * SPAN_BYTES + (size_t)g * MM_GRAN_SIZE;
+}
+
+//returns the granules of the object starting at granule g of s
+static unsigned object_granules(gran_span_t *s, unsigned g) {
+    unsigned i = g / 64;
+    uint64_t w = s->last[i] >> g % 64;
+
+    if(w != 0) {
+        return __builtin_ctzll(w) + 1;
+    }
+    while((w = s->last[++i]) == 0) {
+    }
+    return i * 64 + __builtin_ctzll(w) - g + 1;
+}
+
+//returns the length of the run of clear bits in used that holds bit g
+static unsigned run_through(const uint64_t *used, unsigned g) {
+    unsigned i = g / 64, b = g % 64, down, up;
+    uint64_t w;
+
+    //clear bits from g down, g included
+    if((w = used[i] << (63 - b)) != 0) {
+        down = __builtin_clzll(w);
+    } else {
+        for(down = b + 1; i > 0; down += 64) {
+            if(used[--i] != 0) {
+                down += __builtin_clzll(used[i]);
+                break;
+            }
+        }
+    }
+    //and from g up
+    i = g / 64;
+    if((w = used[i] >> b) != 0) {
+        up = __builtin_ctzll(w);
+    } else {
+        for(up = 64 - b; ++i < WORDS; up += 64) {
+            if(used[i] != 0) {
+                up += __builtin_ctzll(used[i]);
+                break;
+            }
+        }
+    }
+    return down + up - 1;
+}
+
+//sets or clears bits g to g + n - 1 of map
+static void set_bits(uint64_t *map, unsigned g, unsigned n, int on) {
+    unsigned b, k;
+    uint64_t m;
+
+    while(n > 0) {
+        b = g % 64;
+        k = n < 64 - b ? n : 64 - b;
+        m = (k == 64 ? ~0ULL : (1ULL << k) - 1) << b;
+        if(on) {
+            map[g / 64] |= m;
+        } else {
+            map[g / 64] &= ~m;
+        }
+        g += k;
+        n -= k;
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * mmgran.h - granule bitmaps for medium requests in the mm package
+ *
+ * After mm_gran_start(), requests of MM_GRAN_MIN to MM_GRAN_MAX bytes are
+ * served from a reservation of their own, cut into spans of
+ * 2^MM_GRAN_SHIFT bytes. Each span is a row of MM_GRAN_SIZE-byte granules
+ * tracked by two bitmaps kept apart from the payloads: one bit per
+ * granule in use and one per granule that ends an object. Objects carry
+ * no boundary tags, so allocating is a search for a run of clear bits,
+ * freeing clears them again, and neither touches the span's pages.
+ */
+#include <stddef.h>
+
+#define MM_GRAN_MIN 128             /* smallest request served by a span */
+#define MM_GRAN_MAX 4096            /* largest one */
+#define MM_GRAN_SIZE 16             /* bytes in a granule */
+#define MM_GRAN_SHIFT 16            /* log2 of the bytes in one span */
+#define MM_GRAN_SPANS 256           /* spans in the reservation */
+
+int mm_gran_start(void);
+void mm_gran_stop(void);
+void mm_gran_reset(void);
+size_t mm_gran_heapsize(void);
+const char *mm_gran_search(void);
+
+/*
+ * Hooks called by mm.c. mm_malloc hands requests of MM_GRAN_MIN to
+ * MM_GRAN_MAX bytes to mm_gran_malloc while mm_gran_on is set; a NULL
+ * result means the request goes to the heap as usual. mm_free and
+ * mm_realloc hand every pointer for which MM_GRAN_OWNS holds to
+ * mm_gran_free. None of this is thread safe.
+ */
+extern int mm_gran_on;
+extern char *mm_gran_base;
+extern size_t mm_gran_span;
+
+//one unsigned compare; always false while there is no reservation
+#define MM_GRAN_OWNS(p) \
+    ((size_t)((char *)(p) - mm_gran_base) < mm_gran_span)
+
+void *mm_gran_malloc(size_t size);
+void mm_gran_free(void *bp);
+size_t mm_gran_size(void *bp);
@@ -0,0 +1,298 @@
+/*
+ * mmguard.c - sampled guard page allocations for the mm package
+ *
+ * The pool is one mapping of 2 * nslots + 1 pages in which slot pages
+ * and PROT_NONE guard pages alternate:
+ *
+ *     | guard | slot 0 | guard | slot 1 | guard | ... | slot n-1 | guard |
+ *
+ * A sampled block gets a slot page to itself and is pushed against its
+ * right or left end at random, so either an overflow or an underflow
+ * runs straight into a guard page. Freeing a block protects its slot
+ * again and gives the page back to the kernel. Free slots are reused in
+ * FIFO order, so a freed slot stays inaccessible until every other free
+ * slot has been used once.
+ *
+ * As in GWP-ASan, the interval between samples is drawn uniformly from
+ * [1, 2 * rate - 1] calls; the fast path in mm_malloc is a decrement and
+ * a branch on mm_guard_countdown, and the one in mm_free is a single
+ * compare against the pool. None of this is thread safe by itself;
+ * while the default heap is shared, mm.c calls it under heap_lock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include "mmguard.h"
+
+#define MAXDEPTH 16         //frames kept per allocation and free
+#define SKIPFRAMES 1        //mm_guard_malloc or mm_guard_free itself
+#define ALIGN(size) (((size) + 7) & ~(size_t)0x7)
+
+//what is in a slot
+enum { SLOT_UNUSED, SLOT_LIVE, SLOT_FREED };
+
+typedef struct slot {
+    char *bp;               //payload address of the last block served here
+    size_t size;            //its requested bytes
+    int state;
+    int adepth, fdepth;     //frames in apcs and fpcs
+    void *apcs[MAXDEPTH];   //where the block was allocated
+    void *fpcs[MAXDEPTH];   //where it was freed
+} slot_t;
+
+long mm_guard_countdown = LONG_MAX;
+char *mm_guard_pool;
+size_t mm_guard_poolsize;
+
+static unsigned rate;               //mean calls between samples, 0 if off
+static unsigned long long rng = 2463534242ULL;
+static size_t pagesize;
+
+static slot_t *slots;
+static unsigned nslots;
+static unsigned *ring;              //free slots, oldest free first
+static unsigned head, nfree;
+
+static struct sigaction old_segv;
+
+static long next_interval(void);
+static char *slot_page(unsigned i);
+static void release_slot(unsigned i);
+static void report(const char *what, void *addr, slot_t *s);
+static void segv_handler(int sig, siginfo_t *si, void *ctx);
+
+/*
+ * mm_guard_start - serve about one mm_malloc call in rate from a pool of
+ * guarded slots. The pool is made by the first call; later calls only
+ * change the rate. Returns -1 if the pool cannot be set up.
+ */
+int mm_guard_start(unsigned r, unsigned n) {
+    struct sigaction sa;
+    unsigned i;
+
+    if(mm_guard_pool == NULL) {
+        if(n == 0) {
+            return -1;
+        }
+        pagesize = sysconf(_SC_PAGESIZE);
+        slots = calloc(n, sizeof(slot_t));
+        ring = malloc(n * sizeof(unsigned));
+        mm_guard_pool = mmap(NULL, (2 * (size_t)n + 1) * pagesize, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                             -1, 0);
+        if(slots == NULL || ring == NULL || mm_guard_pool == MAP_FAILED) {
+            free(slots);
+            free(ring);
+            mm_guard_pool = NULL;
+            return -1;
+        }
+        mm_guard_poolsize = (2 * (size_t)n + 1) * pagesize;
+        nslots = nfree = n;
+        head = 0;
+        for(i = 0; i < n; i++) {
+            ring[i] = i;
+        }
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = segv_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_SIGINFO;
+        sigaction(SIGSEGV, &sa, &old_segv);
+    }
+    rate = r;
+    mm_guard_countdown = rate ? next_interval() : LONG_MAX;
+    return 0;
+}
+
+/*
+ * mm_guard_stop - stop sampling. Blocks already in the pool stay there
+ * until they are freed.
+ */
+void mm_guard_stop(void) {
+    rate = 0;
+    mm_guard_countdown = LONG_MAX;
+}
+
+/*
+ * mm_guard_reset - free every live slot. Called by mm_init, which drops
+ * all the blocks of the default heap at once.
+ */
+void mm_guard_reset(void) {
+    unsigned i;
+
+    for(i = 0; i < nslots; i++) {
+        if(slots[i].state == SLOT_LIVE) {
+            slots[i].state = SLOT_FREED;
+            slots[i].fdepth = 0;
+            release_slot(i);
+        }
+    }
+}
+
+/*
+ * mm_guard_malloc - slow path of mm_malloc, taken when the countdown
+ * expires. Returns a guarded block, or NULL if size does not fit in a
+ * page or every slot is in use.
+ */
+void *mm_guard_malloc(size_t size) {
+    void *pcs[MAXDEPTH + SKIPFRAMES];
+    slot_t *s;
+    char *page;
+    unsigned i;
+    int depth;
+
+    if(rate == 0) {
+        mm_guard_countdown = LONG_MAX;
+        return NULL;
+    }
+    mm_guard_countdown = next_interval();
+    if(size == 0 || size > pagesize || nfree == 0) {
+        return NULL;
+    }
+    i = ring[head];
+    page = slot_page(i);
+    if(mprotect(page, pagesize, PROT_READ | PROT_WRITE) < 0) {
+        return NULL;
+    }
+    head = (head + 1) % nslots;
+    nfree--;
+
+    s = &slots[i];
+    s->bp = (rng & 1) ? page + pagesize - ALIGN(size) : page;
+    s->size = size;
+    s->state = SLOT_LIVE;
+    depth = backtrace(pcs, MAXDEPTH + SKIPFRAMES) - SKIPFRAMES;
+    s->adepth = depth < 0 ? 0 : depth;
+    memcpy(s->apcs, pcs + SKIPFRAMES, s->adepth * sizeof(void *));
+    return s->bp;
+}
+
+/*
+ * mm_guard_free - protect a guarded block's slot and queue it for reuse.
+ * Double and invalid frees are reported and abort the program.
+ */
+void mm_guard_free(void *bp) {
+    void *pcs[MAXDEPTH + SKIPFRAMES];
+    size_t page = ((char *)bp - mm_guard_pool) / pagesize;
+    slot_t *s = (page & 1) ? &slots[page / 2] : NULL;
+    int depth;
+
+    if(s && s->state == SLOT_FREED && s->bp == bp) {
+        report("double free", bp, s);
+        abort();
+    }
+    if(s == NULL || s->state != SLOT_LIVE || s->bp != bp) {
+        report("invalid free", bp, s);
+        abort();
+    }
+    s->state = SLOT_FREED;
+    depth = backtrace(pcs, MAXDEPTH + SKIPFRAMES) - SKIPFRAMES;
+    s->fdepth = depth < 0 ? 0 : depth;
+    memcpy(s->fpcs, pcs + SKIPFRAMES, s->fdepth * sizeof(void *));
+    release_slot(s - slots);
+}
+
+/*
+ * mm_guard_size - requested size of a live guarded block
+ */
+size_t mm_guard_size(void *bp) {
+    return slots[((char *)bp - mm_guard_pool) / pagesize / 2].size;
+}
+
+//draws the calls until the next sample, minus the one that takes it
+static long next_interval(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (long)(rng % (2 * (unsigned long long)rate - 1));
+}
+
+static char *slot_page(unsigned i) {
+    return mm_guard_pool + (2 * (size_t)i + 1) * pagesize;
+}
+
+//protects slot i, drops its page and puts it at the back of the ring
+static void release_slot(unsigned i) {
+    char *page = slot_page(i);
+
+    mprotect(page, pagesize, PROT_NONE);
+    madvise(page, pagesize, MADV_DONTNEED);
+    ring[(head + nfree) % nslots] = i;
+    nfree++;
+}
+
+/*
+ * prints what happened at addr and the history of the block in s. Also
+ * used by the signal handler, so it only formats into a local buffer
+ * and writes with write(2) and backtrace_symbols_fd.
+ */
+static void report(const char *what, void *addr, slot_t *s) {
+    char buf[256];
+    int n;
+
+    n = snprintf(buf, sizeof(buf), "mm_guard: %s at %p", what, addr);
+    if(s && s->state != SLOT_UNUSED) {
+        n += snprintf(buf + n, sizeof(buf) - n, ", %ld bytes from the "
+                      "%zu-byte block at %p", (long)((char *)addr - s->bp),
+                      s->size, s->bp);
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "\n");
+    write(STDERR_FILENO, buf, n);
+    if(s && s->state != SLOT_UNUSED) {
+        write(STDERR_FILENO, "allocated by:\n", 14);
+        backtrace_symbols_fd(s->apcs, s->adepth, STDERR_FILENO);
+    }
+    if(s && s->state == SLOT_FREED) {
+        write(STDERR_FILENO, "freed by:\n", 10);
+        backtrace_symbols_fd(s->fpcs, s->fdepth, STDERR_FILENO);
+    }
+}
+
+/*
+ * SIGSEGV handler: explains faults in the pool, then puts the previous
+ * handler back and returns, so the faulting access is retried and ends
+ * the program as it would have without us
+ */
+static void segv_handler(int sig, siginfo_t *si, void *ctx) {
+    char *addr = si->si_addr;
+    void *pcs[MAXDEPTH];
+    size_t page;
+    slot_t *s, *left, *right;
+
+    if(MM_GUARD_OWNS(addr)) {
+        page = (addr - mm_guard_pool) / pagesize;
+        s = (page & 1) ? &slots[page / 2] : NULL;
+        if(s && s->state == SLOT_FREED) {
+            report("use after free", addr, s);
+        } else {
+            //a guard page or unused slot: blame the nearer block around it
+            left = page / 2 >= 1 && slots[page / 2 - 1].state != SLOT_UNUSED ?
+                &slots[page / 2 - 1] : NULL;
+            right = (page + 1) / 2 < nslots &&
+                slots[(page + 1) / 2].state != SLOT_UNUSED ?
+                &slots[(page + 1) / 2] : NULL;
+            if(left && right &&
+               right->bp - addr < addr - (left->bp + left->size)) {
+                left = NULL;
+            }
+            s = left ? left : right;
+            if(s == NULL) {
+                report("wild access", addr, NULL);
+            } else if(s->state == SLOT_FREED) {
+                report("use after free", addr, s);
+            } else {
+                report(s == left ? "buffer overflow" : "buffer underflow",
+                       addr, s);
+            }
+        }
+        write(STDERR_FILENO, "accessed by:\n", 13);
+        backtrace_symbols_fd(pcs, backtrace(pcs, MAXDEPTH), STDERR_FILENO);
+    }
+    sigaction(SIGSEGV, &old_segv, NULL);
+}
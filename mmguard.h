@@ -0,0 +1,33 @@
+/*
+ * mmguard.h - sampled guard page allocations for the mm package
+ *
+ * Roughly one mm_malloc call in mm_guard_start(rate, ...) is served from
+ * a separate pool where every block has a page of its own next to a
+ * PROT_NONE guard page, so an overflow or underflow faults right away.
+ * Freed slots are protected too and only reused after every other free
+ * slot, which catches most uses after free. Faults in the pool are
+ * reported with the stacks of the block's allocation and free.
+ */
+#include <stddef.h>
+
+int mm_guard_start(unsigned rate, unsigned slots);
+void mm_guard_stop(void);
+void mm_guard_reset(void);
+
+/*
+ * Hooks called by mm.c. mm_malloc decrements mm_guard_countdown and only
+ * calls mm_guard_malloc once it goes negative; a NULL result means the
+ * request goes to the heap as usual. mm_free and mm_realloc hand every
+ * pointer for which MM_GUARD_OWNS holds to mm_guard_free.
+ */
+extern long mm_guard_countdown;
+extern char *mm_guard_pool;
+extern size_t mm_guard_poolsize;
+
+//one unsigned compare; always false while there is no pool
+#define MM_GUARD_OWNS(p) \
+    ((size_t)((char *)(p) - mm_guard_pool) < mm_guard_poolsize)
+
+void *mm_guard_malloc(size_t size);
+void mm_guard_free(void *bp);
+size_t mm_guard_size(void *bp);
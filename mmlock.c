@@ -0,0 +1,122 @@
+/*
+ * mmlock.c - spin-then-park locks for the mm package
+ *
+ * The lock word follows Drepper's "Futexes Are Tricky": 0 is free, 1 is
+ * held and 2 is held with possible sleepers, so mm_unlock only makes the
+ * futex system call when somebody may be asleep. An uncontended
+ * mm_lock/mm_unlock pair is one compare-and-swap and one exchange. A
+ * contended mm_lock spins for up to SPIN_LIMIT rounds, in case the
+ * holder is running on another CPU and about to let go, before it parks;
+ * on a single CPU the holder cannot be running, so it parks at once.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "mmlock.h"
+
+#define SPIN_LIMIT 100      //compare-and-swap attempts before parking
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+static mm_lock_t *locks;    //named locks, newest first
+static int spin_limit = -1; //SPIN_LIMIT, or 0 on one CPU; -1 until known
+
+static unsigned long long now_ns(void);
+
+/*
+ * mm_lock_init - names a lock and adds it to the mm_lock_print list.
+ * Only call it once per lock, before any thread can take it.
+ */
+void mm_lock_init(mm_lock_t *l, const char *name) {
+    l->name = name;
+    l->next = locks;
+    locks = l;
+}
+
+/*
+ * mm_lock - takes l, spinning and then sleeping while it is held
+ */
+void mm_lock(mm_lock_t *l) {
+    unsigned long long start;
+    int c = 0, i;
+
+    if(__atomic_compare_exchange_n(&l->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                   __ATOMIC_RELAXED)) {
+        l->acquires++;
+        return;
+    }
+    start = now_ns();
+    if(spin_limit < 0) {
+        spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    }
+    for(i = 0; i < spin_limit; i++) {
+        CPU_RELAX();
+        c = 0;
+        if(__atomic_load_n(&l->state, __ATOMIC_RELAXED) == 0 &&
+           __atomic_compare_exchange_n(&l->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED)) {
+            goto acquired;
+        }
+    }
+
+    //mark the lock as having sleepers and sleep until it is free
+    while(__atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        syscall(SYS_futex, &l->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+    }
+acquired:
+    l->acquires++;
+    l->contended++;
+    l->wait_ns += now_ns() - start;
+}
+
+/*
+ * mm_unlock - releases l, waking one sleeper if there may be any
+ */
+void mm_unlock(mm_lock_t *l) {
+    if(__atomic_exchange_n(&l->state, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, &l->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+ * mm_lock_reset - zeroes the counters of every named lock
+ */
+void mm_lock_reset(void) {
+    mm_lock_t *l;
+
+    for(l = locks; l != NULL; l = l->next) {
+        l->acquires = l->contended = 0;
+        l->wait_ns = 0;
+    }
+}
+
+/*
+ * mm_lock_print - writes a table of the counters of every named lock
+ */
+void mm_lock_print(FILE *fp) {
+    mm_lock_t *l;
+
+    fprintf(fp, "%12s%12s%12s%8s%12s%10s\n", "lock", "acquires",
+            "contended", "%", "wait ms", "ns/wait");
+    for(l = locks; l != NULL; l = l->next) {
+        fprintf(fp, "%12s%12lu%12lu%8.2f%12.3f%10.0f\n", l->name,
+                l->acquires, l->contended,
+                l->acquires ? 100.0 * l->contended / l->acquires : 0.0,
+                l->wait_ns / 1e6,
+                l->contended ? (double)l->wait_ns / l->contended : 0.0);
+    }
+}
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,28 @@
+/*
+ * mmlock.h - spin-then-park locks for the mm package
+ *
+ * An mm_lock_t is a futex word that mm_lock() first tries to take by
+ * spinning briefly and then sleeps on in the kernel. Each lock counts
+ * its acquisitions, how many of them found it held and the time spent
+ * waiting for those. The counters are only updated by the holder, so
+ * they cost no atomic instructions. Locks given a name with
+ * mm_lock_init() are listed by mm_lock_print().
+ */
+#include <stdio.h>
+
+typedef struct mm_lock {
+    int state;                      //0 free, 1 held, 2 held with sleepers
+    const char *name;
+    unsigned long acquires;         //mm_lock calls
+    unsigned long contended;        //of those, calls that had to wait
+    unsigned long long wait_ns;     //time those spent waiting
+    struct mm_lock *next;           //next lock in the mm_lock_print list
+} mm_lock_t;
+
+#define MM_LOCK_INITIALIZER {0, NULL, 0, 0, 0, NULL}
+
+void mm_lock_init(mm_lock_t *l, const char *name);
+void mm_lock(mm_lock_t *l);
+void mm_unlock(mm_lock_t *l);
+void mm_lock_reset(void);
+void mm_lock_print(FILE *fp);
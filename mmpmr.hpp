@@ -0,0 +1,300 @@
+/*
+ * mmpmr.hpp - header-only C++ adapters over the mm package (C++17)
+ *
+ *   mm::memory_resource    std::pmr::memory_resource over one mm heap
+ *   mm::allocator<T>       stateless std::allocator replacement
+ *   mm::arena_resource     monotonic std::pmr resource over an mm arena
+ *   MM_REPLACE_GLOBAL_NEW_DELETE
+ *                          expands to replacements for every global
+ *                          operator new/delete; use it in exactly one
+ *                          translation unit
+ *
+ * mm_malloc payloads are 8-byte aligned. Stricter alignments are served
+ * by over-allocating and keeping the block's real address in the word
+ * just below the aligned pointer; the deallocation functions get the
+ * alignment back from their callers and undo this. Requests too big for
+ * a heap block fail like an exhausted heap.
+ *
+ * Only the default heap can be made thread safe, by mm_caches or
+ * mm_maint_start (see mm.h), and that covers memory_resource and
+ * allocator while they use it. A memory_resource over a heap of its own,
+ * an arena_resource and the heap behind MM_REPLACE_GLOBAL_NEW_DELETE
+ * take no locks, so a program that replaces the global operator new must
+ * not allocate from more than one thread.
+ */
+#ifndef MMPMR_HPP
+#define MMPMR_HPP
+
+#include <cstddef>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+
+#include "mm.h"
+#include "mmarena.h"
+
+namespace mm {
+
+namespace detail {
+
+// alignment of every mm_malloc payload
+constexpr std::size_t natural_align = 8;
+
+// largest request a heap can serve: its block, tags included, has to
+// fit the 32-bit size in the tags and the int that memlib's sbrk takes
+constexpr std::size_t max_bytes = INT_MAX - 2 * natural_align;
+
+// mm_malloc or mm_heap_malloc; a null heap means the default heap
+inline void *heap_malloc(mm_heap_t *h, std::size_t bytes) {
+    if (bytes == 0)
+        bytes = 1;
+    if (bytes > max_bytes)
+        return nullptr;
+    return h ? mm_heap_malloc(h, bytes) : mm_malloc(bytes);
+}
+
+inline void heap_free(mm_heap_t *h, void *p) {
+    if (h)
+        mm_heap_free(h, p);
+    else
+        mm_free(p);
+}
+
+// returns bytes aligned to align, or nullptr if the heap is exhausted
+inline void *aligned_malloc(mm_heap_t *h, std::size_t bytes,
+                            std::size_t align) {
+    if (align <= natural_align)
+        return heap_malloc(h, bytes);
+    if (align > max_bytes || bytes > max_bytes - align - sizeof(void *))
+        return nullptr;
+
+    void *raw = heap_malloc(h, bytes + align + sizeof(void *));
+    if (raw == nullptr)
+        return nullptr;
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *);
+    p = (p + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+    reinterpret_cast<void **>(p)[-1] = raw;
+    return reinterpret_cast<void *>(p);
+}
+
+inline void aligned_free(mm_heap_t *h, void *p, std::size_t align) {
+    if (p == nullptr)
+        return;
+    if (align > natural_align)
+        p = *reinterpret_cast<void **>(reinterpret_cast<std::uintptr_t>(p) -
+                                       sizeof(void *));
+    heap_free(h, p);
+}
+
+// the heap behind the global operator new, made on first use so that it
+// works before main and independently of mem_init/mm_init
+inline mm_heap_t *global_heap() {
+    static mm_heap_t *h = mm_heap_create();
+    if (h == nullptr)
+        throw std::bad_alloc();
+    return h;
+}
+
+} // namespace detail
+
+/*
+ * memory_resource - a std::pmr::memory_resource backed by one mm heap
+ * (the default heap if none is given). Two resources compare equal when
+ * they allocate from the same heap.
+ */
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(mm_heap_t *heap = nullptr) noexcept
+        : heap_(heap) {}
+
+    mm_heap_t *heap() const noexcept { return heap_; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        void *p = detail::aligned_malloc(heap_, bytes, align);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t align) override {
+        detail::aligned_free(heap_, p, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other)
+        const noexcept override {
+        auto *o = dynamic_cast<const memory_resource *>(&other);
+        return o != nullptr && o->heap_ == heap_;
+    }
+
+    mm_heap_t *heap_;
+};
+
+// a memory_resource for the default heap
+inline memory_resource *default_resource() noexcept {
+    static memory_resource r;
+    return &r;
+}
+
+/*
+ * allocator - a stateless allocator over the default heap, usable
+ * wherever std::allocator is
+ */
+template <class T>
+struct allocator {
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        void *p = detail::aligned_malloc(nullptr, n * sizeof(T), alignof(T));
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t) noexcept {
+        detail::aligned_free(nullptr, p, alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+/*
+ * arena_resource - a monotonic std::pmr resource over an mm arena.
+ * Deallocation is a no-op; release() frees everything at once by
+ * rewinding the arena onto the chunks it already has, and the
+ * destructor frees the arena.
+ */
+class arena_resource : public std::pmr::memory_resource {
+public:
+    explicit arena_resource(std::size_t chunksize = 0)
+        : arena_(mm_arena_create(chunksize)) {
+        if (arena_ == nullptr)
+            throw std::bad_alloc();
+    }
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+    ~arena_resource() override { mm_arena_destroy(arena_); }
+
+    void release() noexcept { mm_arena_reset(arena_); }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        std::size_t extra = align > detail::natural_align ? align : 0;
+        if (extra > detail::max_bytes || bytes > detail::max_bytes - extra)
+            throw std::bad_alloc();
+        void *raw = mm_arena_alloc(arena_, bytes + extra);
+        if (raw == nullptr)
+            throw std::bad_alloc();
+        std::uintptr_t p = reinterpret_cast<std::uintptr_t>(raw);
+        if (extra)
+            p = (p + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+        return reinterpret_cast<void *>(p);
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other)
+        const noexcept override {
+        return this == &other;
+    }
+
+    mm_arena_t *arena_;
+};
+
+} // namespace mm
+
+/*
+ * MM_REPLACE_GLOBAL_NEW_DELETE - replacement global allocation functions
+ * (plain, array, nothrow, sized and aligned) that allocate from a heap of
+ * their own. Replacements may not be inline, so the definitions are only
+ * emitted where this macro is expanded.
+ */
+#define MM_REPLACE_GLOBAL_NEW_DELETE                                          \
+    void *operator new(std::size_t n) {                                       \
+        void *p = mm::detail::heap_malloc(mm::detail::global_heap(), n);      \
+        if (p == nullptr)                                                     \
+            throw std::bad_alloc();                                           \
+        return p;                                                             \
+    }                                                                         \
+    void *operator new[](std::size_t n) { return operator new(n); }           \
+    void *operator new(std::size_t n, const std::nothrow_t &) noexcept {      \
+        try { return operator new(n); } catch (...) { return nullptr; }       \
+    }                                                                         \
+    void *operator new[](std::size_t n, const std::nothrow_t &) noexcept {    \
+        try { return operator new(n); } catch (...) { return nullptr; }       \
+    }                                                                         \
+    void *operator new(std::size_t n, std::align_val_t a) {                   \
+        void *p = mm::detail::aligned_malloc(mm::detail::global_heap(), n,    \
+                                             static_cast<std::size_t>(a));    \
+        if (p == nullptr)                                                     \
+            throw std::bad_alloc();                                           \
+        return p;                                                             \
+    }                                                                         \
+    void *operator new[](std::size_t n, std::align_val_t a) {                 \
+        return operator new(n, a);                                            \
+    }                                                                         \
+    void *operator new(std::size_t n, std::align_val_t a,                     \
+                       const std::nothrow_t &) noexcept {                     \
+        try { return operator new(n, a); } catch (...) { return nullptr; }    \
+    }                                                                         \
+    void *operator new[](std::size_t n, std::align_val_t a,                   \
+                         const std::nothrow_t &) noexcept {                   \
+        try { return operator new(n, a); } catch (...) { return nullptr; }    \
+    }                                                                         \
+    void operator delete(void *p) noexcept {                                  \
+        if (p)                                                                \
+            mm::detail::heap_free(mm::detail::global_heap(), p);              \
+    }                                                                         \
+    void operator delete[](void *p) noexcept { operator delete(p); }          \
+    void operator delete(void *p, std::size_t) noexcept {                     \
+        operator delete(p);                                                   \
+    }                                                                         \
+    void operator delete[](void *p, std::size_t) noexcept {                   \
+        operator delete(p);                                                   \
+    }                                                                         \
+    void operator delete(void *p, const std::nothrow_t &) noexcept {          \
+        operator delete(p);                                                   \
+    }                                                                         \
+    void operator delete[](void *p, const std::nothrow_t &) noexcept {        \
+        operator delete(p);                                                   \
+    }                                                                         \
+    void operator delete(void *p, std::align_val_t a) noexcept {              \
+        if (p)                                                                \
+            mm::detail::aligned_free(mm::detail::global_heap(), p,            \
+                                     static_cast<std::size_t>(a));            \
+    }                                                                         \
+    void operator delete[](void *p, std::align_val_t a) noexcept {            \
+        operator delete(p, a);                                                \
+    }                                                                         \
+    void operator delete(void *p, std::size_t, std::align_val_t a) noexcept { \
+        operator delete(p, a);                                                \
+    }                                                                         \
+    void operator delete[](void *p, std::size_t,                              \
+                           std::align_val_t a) noexcept {                     \
+        operator delete(p, a);                                                \
+    }                                                                         \
+    void operator delete(void *p, std::align_val_t a,                         \
+                         const std::nothrow_t &) noexcept {                   \
+        operator delete(p, a);                                                \
+    }                                                                         \
+    void operator delete[](void *p, std::align_val_t a,                       \
+                           const std::nothrow_t &) noexcept {                 \
+        operator delete(p, a);                                                \
+    }
+
+#endif /* MMPMR_HPP */
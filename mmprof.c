@@ -0,0 +1,315 @@
+/*
+ * mmprof.c - sampling heap profiler for the mm package
+ *
+ * Sampling is geometric in bytes, as in tcmalloc: the distance to the
+ * next sample is drawn from an exponential distribution with mean
+ * `rate', so the cost of taking a backtrace is amortized over roughly
+ * `rate' bytes of allocation regardless of the request sizes. The fast
+ * path in mm_malloc is a single subtract and branch on mm_prof_countdown.
+ *
+ * Sampled live allocations are kept in an open addressing table keyed
+ * by payload address, allocated with libc malloc so the profiler never
+ * perturbs the simulated heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <execinfo.h>
+
+#include "mmprof.h"
+
+#define MAXDEPTH 32         //frames kept per sample
+#define MAXSKIP 8           //frames of mm.c above the caller, at most
+#define SKIPFRAMES 2        //mm_prof_sample and mm_heap_malloc, when no
+                            //frame returns to mm_prof_caller
+#define MINSLOTS 256        //initial table size (power of 2)
+
+//one sampled live allocation
+typedef struct sample {
+    void *bp;               //payload address, NULL if the slot is empty
+    size_t size;            //requested bytes
+    int depth;              //frames in pcs
+    void *pcs[MAXDEPTH];    //return addresses, innermost first
+} sample_t;
+
+long mm_prof_countdown = LONG_MAX;
+__thread void *mm_prof_caller;
+
+static size_t rate;                 //mean bytes between samples, 0 if off
+static unsigned long long rng = 88172645463325252ULL;
+
+static sample_t *table;             //open addressing, linear probing
+static size_t nslots;
+static size_t nlive;
+
+//dump requested by the signal handler, served on the next sample
+static volatile sig_atomic_t dump_pending;
+static char dump_path[256];
+
+static size_t next_interval(void);
+static size_t slot_of(void *bp);
+static int grow_table(void);
+static void dump_frame(FILE *fp, void *pc);
+
+/*
+ * mm_prof_start - start sampling about once every rate bytes
+ */
+void mm_prof_start(size_t r) {
+    rate = r;
+    mm_prof_countdown = rate ? (long)next_interval() : LONG_MAX;
+}
+
+/*
+ * mm_prof_stop - stop taking new samples. Allocations that were already
+ * sampled stay in the table until they are freed.
+ */
+void mm_prof_stop(void) {
+    rate = 0;
+    mm_prof_countdown = LONG_MAX;
+}
+
+/*
+ * mm_prof_reset - forget every sampled allocation. Called by mm_init,
+ * since a fresh heap invalidates all payload addresses.
+ */
+void mm_prof_reset(void) {
+    if(table) {
+        memset(table, 0, nslots * sizeof(sample_t));
+    }
+    nlive = 0;
+}
+
+/*
+ * mm_prof_forget - forget the sampled allocations whose payloads lie in
+ * [lo, hi], e.g. because the heap holding them was destroyed
+ */
+void mm_prof_forget(void *lo, void *hi) {
+    size_t i = 0;
+
+    //deleting shifts later entries back into slot i, so only advance
+    //past entries that are kept
+    while(i < nslots) {
+        void *bp = table[i].bp;
+
+        if(bp != NULL && bp >= lo && bp <= hi) {
+            mm_prof_free(bp);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * mm_prof_dump - write the sampled live allocations to fp in folded
+ * stack format. Each line is weighted by the estimated number of bytes
+ * it stands for, size / (1 - e^(-size/rate)), which makes the totals
+ * unbiased. Returns the number of samples written.
+ */
+int mm_prof_dump(FILE *fp) {
+    size_t i;
+    int j, n = 0;
+    double r = rate ? (double)rate : 1.0;
+
+    for(i = 0; i < nslots; i++) {
+        sample_t *s = &table[i];
+        double weight;
+
+        if(s->bp == NULL) {
+            continue;
+        }
+        for(j = s->depth - 1; j >= 0; j--) {
+            dump_frame(fp, s->pcs[j]);
+            fputc(j ? ';' : ' ', fp);
+        }
+        weight = s->size / (1.0 - exp(-(double)s->size / r));
+        fprintf(fp, "%.0f\n", weight);
+        n++;
+    }
+    fflush(fp);
+    return n;
+}
+
+/*
+ * signal handler: only flags the dump and forces the next mm_malloc
+ * onto the slow path, where it is safe to do stdio
+ */
+static void dump_handler(int sig) {
+    dump_pending = 1;
+    mm_prof_countdown = -1;
+}
+
+/*
+ * mm_prof_dump_on_signal - dump the profile to path whenever sig arrives.
+ * The dump is written by the first mm_malloc after the signal.
+ */
+int mm_prof_dump_on_signal(int sig, const char *path) {
+    struct sigaction sa;
+
+    strncpy(dump_path, path, sizeof(dump_path) - 1);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(sig, &sa, NULL);
+}
+
+/*
+ * mm_prof_sample - slow path of mm_malloc, taken when the byte countdown
+ * expires. Records bp with its backtrace; returns 1 if it was recorded.
+ */
+int mm_prof_sample(void *bp, size_t size) {
+    void *pcs[MAXDEPTH + MAXSKIP];
+    sample_t *s;
+    int depth, skip;
+
+    if(dump_pending) {
+        FILE *fp;
+
+        dump_pending = 0;
+        if((fp = fopen(dump_path, "w")) != NULL) {
+            mm_prof_dump(fp);
+            fclose(fp);
+        }
+    }
+    if(rate == 0) {
+        mm_prof_countdown = LONG_MAX;
+        return 0;
+    }
+    mm_prof_countdown = (long)next_interval();
+
+    //keep the load factor under 1/2
+    if(2 * (nlive + 1) > nslots && grow_table() < 0) {
+        return 0;
+    }
+
+    //frame 0 is this function's own
+    depth = backtrace(pcs, MAXDEPTH + MAXSKIP);
+    for(skip = 1; skip < depth && skip <= MAXSKIP; skip++) {
+        if(pcs[skip] == mm_prof_caller) {
+            break;
+        }
+    }
+    if(skip >= depth || skip > MAXSKIP) {
+        skip = SKIPFRAMES;
+    }
+    depth -= skip;
+    if(depth < 0) {
+        depth = 0;
+    } else if(depth > MAXDEPTH) {
+        depth = MAXDEPTH;
+    }
+    s = &table[slot_of(bp)];
+    s->bp = bp;
+    s->size = size;
+    s->depth = depth;
+    memcpy(s->pcs, pcs + skip, depth * sizeof(void *));
+    nlive++;
+    return 1;
+}
+
+/*
+ * mm_prof_free - drop a sampled allocation from the table. Uses backward
+ * shift deletion so lookups never need tombstones.
+ */
+void mm_prof_free(void *bp) {
+    size_t mask = nslots - 1;
+    size_t i, j, home;
+
+    if(nslots == 0) {
+        return;
+    }
+    i = slot_of(bp);
+    if(table[i].bp != bp) {
+        return;
+    }
+    table[i].bp = NULL;
+    nlive--;
+
+    //move later entries of the probe run into the hole
+    for(j = (i + 1) & mask; table[j].bp != NULL; j = (j + 1) & mask) {
+        home = ((size_t)table[j].bp >> 3) * 0x9E3779B97F4A7C15ULL & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            table[i] = table[j];
+            table[j].bp = NULL;
+            i = j;
+        }
+    }
+}
+
+/*
+ * mm_prof_move - follow a sampled allocation that mm_compact relocated
+ */
+void mm_prof_move(void *from, void *to) {
+    sample_t s;
+    size_t i;
+
+    if(nslots == 0 || table[i = slot_of(from)].bp != from) {
+        return;
+    }
+    s = table[i];
+    mm_prof_free(from);
+    s.bp = to;
+    table[slot_of(to)] = s;
+    nlive++;
+}
+
+//draws the bytes until the next sample: -ln(U) * rate, U uniform in (0,1]
+static size_t next_interval(void) {
+    double u;
+
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    u = ((rng >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (size_t)(-log(u) * rate) + 1;
+}
+
+//returns the slot holding bp, or the empty slot where it belongs
+static size_t slot_of(void *bp) {
+    size_t mask = nslots - 1;
+    size_t i = ((size_t)bp >> 3) * 0x9E3779B97F4A7C15ULL & mask;
+
+    while(table[i].bp != NULL && table[i].bp != bp) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+//doubles the table and rehashes the live samples
+static int grow_table(void) {
+    sample_t *old = table;
+    size_t oldslots = nslots;
+    size_t newslots = nslots ? 2 * nslots : MINSLOTS;
+    size_t i;
+
+    if((table = calloc(newslots, sizeof(sample_t))) == NULL) {
+        table = old;
+        return -1;
+    }
+    nslots = newslots;
+    for(i = 0; i < oldslots; i++) {
+        if(old[i].bp != NULL) {
+            table[slot_of(old[i].bp)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+//prints one frame as its symbol name if known, else its address
+static void dump_frame(FILE *fp, void *pc) {
+    char **sym = backtrace_symbols(&pc, 1);
+    char *name, *end;
+
+    //glibc formats frames as "object(function+0xoff) [0xaddr]"
+    if(sym && (name = strchr(sym[0], '(')) != NULL &&
+       (end = strchr(name, '+')) != NULL && end > name + 1) {
+        fprintf(fp, "%.*s", (int)(end - name - 1), name + 1);
+    } else {
+        fprintf(fp, "%p", pc);
+    }
+    free(sym);
+}
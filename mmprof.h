@@ -0,0 +1,33 @@
+/*
+ * mmprof.h - sampling heap profiler for the mm package
+ *
+ * Roughly one allocation per mm_prof_start(rate) bytes requested is
+ * sampled: its stack is recorded in a side table until it is freed.
+ * mm_prof_dump() writes the sampled live allocations as folded stacks
+ * ("frame;frame;frame bytes" lines, root first), weighted to estimate
+ * the live bytes owned by each allocation site.
+ */
+#include <stdio.h>
+
+void mm_prof_start(size_t rate);
+void mm_prof_stop(void);
+void mm_prof_reset(void);
+void mm_prof_forget(void *lo, void *hi);
+int mm_prof_dump(FILE *fp);
+int mm_prof_dump_on_signal(int sig, const char *path);
+
+/*
+ * Hooks called by mm.c. mm_malloc subtracts each request from
+ * mm_prof_countdown and only calls mm_prof_sample once it goes negative;
+ * mm_prof_sample returns nonzero if bp was recorded, in which case
+ * mm_free must call mm_prof_free for it. mm_malloc and mm_realloc set
+ * mm_prof_caller to their return address, and a sample's stack starts at
+ * the frame that returns there, so it begins in their caller however
+ * deep in mm.c the sample was taken. Without a match, as for calls
+ * straight to mm_heap_malloc, it starts in mm_heap_malloc's caller.
+ */
+extern long mm_prof_countdown;
+extern __thread void *mm_prof_caller;
+int mm_prof_sample(void *bp, size_t size);
+void mm_prof_free(void *bp);
+void mm_prof_move(void *from, void *to);
@@ -0,0 +1,148 @@
+/*
+ * mmslab.c - size-class slabs for the mm package
+ *
+ * The reservation is MM_SLAB_CLASSES slices of 2^MM_SLAB_SHIFT bytes,
+ * and slice i is a memlib region holding only objects of
+ * MM_SLAB_SIZE(i) bytes:
+ *
+ *     | 8-byte objects | 16-byte objects | ... | MM_SLAB_MAX-byte objects |
+ *     ^ mm_slab_base
+ *
+ * A class carves objects out of its slice's brk, SLAB_CHUNK bytes and
+ * one page fault at a time, and keeps the objects freed to it on a LIFO
+ * list linked through their first word. Once its slice is full,
+ * mm_slab_malloc returns NULL for the class until mm_slab_reset, and its
+ * requests go to the heap.
+ */
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+#include "mmslab.h"
+
+#define SLAB_CHUNK (1 << 12)        //bytes a class takes from its slice at once
+
+typedef struct slab_class {
+    void *free;                     //freed objects, linked
+    char *bump, *end;               //the part of the slice not carved yet
+    int full;                       //the slice has no room left
+    mem_region_t *mem;              //the class's slice
+} slab_class_t;
+
+int mm_slab_on;
+char *mm_slab_base;
+size_t mm_slab_span;
+
+static slab_class_t classes[MM_SLAB_CLASSES];
+
+/*
+ * mm_slab_start - serve small requests from the slabs. The reservation
+ * is made by the first call. Returns -1 if it cannot be set up.
+ */
+int mm_slab_start(void) {
+    size_t slice = (size_t)1 << MM_SLAB_SHIFT;
+    char *base;
+    int i;
+
+    if(mm_slab_base == NULL) {
+        if((base = mem_reserve(MM_SLAB_CLASSES * slice, slice)) == NULL) {
+            return -1;
+        }
+        for(i = 0; i < MM_SLAB_CLASSES; i++) {
+            if((classes[i].mem = mem_region_create_at(base + i * slice,
+                                                      slice)) == NULL) {
+                while(--i >= 0) {
+                    free(classes[i].mem);
+                }
+                munmap(base, MM_SLAB_CLASSES * slice);
+                return -1;
+            }
+        }
+        //a class seldom fills a huge page, so keep the slices on small ones
+        madvise(base, MM_SLAB_CLASSES * slice, MADV_NOHUGEPAGE);
+        mm_slab_base = base;
+        mm_slab_span = MM_SLAB_CLASSES * slice;
+    }
+    mm_slab_on = 1;
+    return 0;
+}
+
+/*
+ * mm_slab_stop - send small requests to the heap again. Objects already
+ * in the slabs stay there until they are freed.
+ */
+void mm_slab_stop(void) {
+    mm_slab_on = 0;
+}
+
+/*
+ * mm_slab_reset - empty every slice. Called by mm_init, which drops all
+ * the blocks of the default heap at once.
+ */
+void mm_slab_reset(void) {
+    int i;
+
+    for(i = 0; mm_slab_base != NULL && i < MM_SLAB_CLASSES; i++) {
+        mem_region_reset_brk(classes[i].mem);
+        classes[i].free = NULL;
+        classes[i].bump = classes[i].end = NULL;
+        classes[i].full = 0;
+    }
+}
+
+/*
+ * mm_slab_heapsize - bytes of all the slices taken so far
+ */
+size_t mm_slab_heapsize(void) {
+    size_t bytes = 0;
+    int i;
+
+    for(i = 0; mm_slab_base != NULL && i < MM_SLAB_CLASSES; i++) {
+        bytes += mem_region_heapsize(classes[i].mem);
+    }
+    return bytes;
+}
+
+/*
+ * mm_slab_malloc - slow path of mm_malloc for 1 to MM_SLAB_MAX bytes.
+ * Returns NULL if the class's slice is full.
+ */
+void *mm_slab_malloc(size_t size) {
+    size_t cls = (size - 1) / MM_SLAB_ALIGN;
+    slab_class_t *c = &classes[cls];
+    char *bp;
+
+    if((bp = c->free) != NULL) {
+        c->free = *(void **)bp;
+        return bp;
+    }
+    if(c->bump + MM_SLAB_SIZE(cls) > c->end) {
+        //chunks follow each other in the slice, so the tail of the last
+        //one is not lost
+        if(c->full ||
+           (bp = mem_region_sbrk(c->mem, SLAB_CHUNK)) == (void *)-1) {
+            c->full = 1;
+            return NULL;
+        }
+        if(bp != c->end) {
+            c->bump = bp;
+        }
+        c->end = bp + SLAB_CHUNK;
+        //take the page fault here rather than in mm_slab_free, which is
+        //the first to write to an object
+        mem_region_populate(c->mem, bp, c->end);
+    }
+    bp = c->bump;
+    c->bump += MM_SLAB_SIZE(cls);
+    return bp;
+}
+
+/*
+ * mm_slab_free - put an object back on its class's list
+ */
+void mm_slab_free(void *bp) {
+    slab_class_t *c = &classes[MM_SLAB_CLASS(bp)];
+
+    *(void **)bp = c->free;
+    c->free = bp;
+}
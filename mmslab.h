@@ -0,0 +1,41 @@
+/*
+ * mmslab.h - size-class slabs for the mm package
+ *
+ * After mm_slab_start(), requests of up to MM_SLAB_MAX bytes are served
+ * from a reservation of their own in which every size class owns one
+ * slice of 2^MM_SLAB_SHIFT bytes, aligned to its size. Objects carry no
+ * header: mm_free finds an object's class, and so its size, from its
+ * address alone with a subtract and a shift.
+ */
+#include <stddef.h>
+
+#define MM_SLAB_MAX 256             /* largest request served by a slab */
+#define MM_SLAB_ALIGN 8             /* classes are multiples of this */
+#define MM_SLAB_CLASSES (MM_SLAB_MAX / MM_SLAB_ALIGN)
+#define MM_SLAB_SHIFT 22            /* log2 of the bytes in one slice */
+
+int mm_slab_start(void);
+void mm_slab_stop(void);
+void mm_slab_reset(void);
+size_t mm_slab_heapsize(void);
+
+/*
+ * Hooks called by mm.c. mm_malloc hands requests of 1 to MM_SLAB_MAX
+ * bytes to mm_slab_malloc while mm_slab_on is set; a NULL result means
+ * the request goes to the heap as usual. mm_free and mm_realloc hand
+ * every pointer for which MM_SLAB_OWNS holds to mm_slab_free. None of
+ * this is thread safe.
+ */
+extern int mm_slab_on;
+extern char *mm_slab_base;
+extern size_t mm_slab_span;
+
+//one unsigned compare; always false while there is no reservation
+#define MM_SLAB_OWNS(p) \
+    ((size_t)((char *)(p) - mm_slab_base) < mm_slab_span)
+#define MM_SLAB_CLASS(p) \
+    ((size_t)((char *)(p) - mm_slab_base) >> MM_SLAB_SHIFT)
+#define MM_SLAB_SIZE(cls) (((cls) + 1) * MM_SLAB_ALIGN)
+
+void *mm_slab_malloc(size_t size);
+void mm_slab_free(void *bp);